@@ -0,0 +1,398 @@
+#pragma once
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <deque>
+#include <sstream>
+#include "MellowSim.h"
+
+#pragma comment(lib, "Ws2_32.lib")
+
+// Distributed tile rendering over TCP.
+// The coordinator (MellowSim.exe --coordinator [port] [local_workers]) listens for workers
+// (MellowSim.exe --worker <host> [port]). Scheduling is pull based: a worker announces itself with HELLO and every
+// RESULT it sends back doubles as the request for its next tile. Workers return iteration counts, which go
+// straight into the coordinator's iteration buffer. Tiles of lost or stuck workers go back into the queue.
+
+const unsigned int dist_magic = 0x4D534454; // "MSDT"
+const unsigned int dist_version = 1;
+const unsigned short dist_default_port = 5555;
+const int dist_tile_rows = 16;
+const ULONGLONG dist_tile_timeout_ms = 30000; // Least time a worker may hold a tile before it is dropped
+const double dist_reference_cost = 2048. * dist_tile_rows * start_max_iter; // Pixel iterations of a tile that fits it
+const ULONGLONG dist_timeout_factor = 4; // A tile may take this many times as long as the slowest one so far
+const ULONGLONG dist_hello_timeout_ms = 5000; // Connections which do not say HELLO in time are closed
+const DWORD dist_recv_timeout_ms = 5000; // Longest wait for the rest of a message once it started
+const DWORD dist_reconnect_ms = 2000;
+const size_t dist_coord_digits = 64;
+
+const unsigned int DIST_HELLO = 1;
+const unsigned int DIST_JOB = 2;
+const unsigned int DIST_RESULT = 3;
+
+#pragma pack(push, 1)
+struct DistHeader {
+    unsigned int magic;
+    unsigned int type;
+    unsigned int job;
+    unsigned int tile;
+    unsigned int first_row;
+    unsigned int n_rows;
+    unsigned int payload_size;
+};
+
+// Coordinates travel as decimal strings so neither side loses precision to the other's long double format
+struct DistView {
+    char x_start[dist_coord_digits];
+    char x_end[dist_coord_digits];
+    char y_start[dist_coord_digits];
+    char y_end[dist_coord_digits];
+    float ratio;
+    int width;
+    float intensity;
+    unsigned long long magnification;
+    unsigned int max_iter;
+    unsigned int kernel;
+};
+#pragma pack(pop)
+
+struct DistWorker {
+    SOCKET socket;
+    bool idle;
+    int tile;
+    ULONGLONG assigned_at;
+};
+
+// A connection which has not sent its HELLO yet, it is only read once select reports data
+struct DistGreeting {
+    SOCKET socket;
+    ULONGLONG accepted_at;
+};
+
+SOCKET dist_listener = INVALID_SOCKET;
+vector<DistWorker> dist_workers;
+vector<DistGreeting> dist_greetings;
+unsigned int dist_job = 0;
+bool use_distributed = false;
+
+bool send_all(SOCKET s, const char* data, size_t size) {
+    while (size > 0) {
+        int sent = send(s, data, (int)size, 0);
+        if (sent <= 0) return false;
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+bool recv_all(SOCKET s, char* data, size_t size) {
+    while (size > 0) {
+        int received = recv(s, data, (int)size, 0);
+        if (received <= 0) return false;
+        data += received;
+        size -= received;
+    }
+    return true;
+}
+
+bool send_message(SOCKET s, DistHeader header, const void* payload) {
+    header.magic = dist_magic;
+    if (!send_all(s, (const char*)&header, sizeof(header))) return false;
+    return header.payload_size == 0 || send_all(s, (const char*)payload, header.payload_size);
+}
+
+// Messages with more than max_payload bytes are refused before anything is allocated for them
+bool recv_message(SOCKET s, DistHeader& header, vector<char>& payload, size_t max_payload) {
+    if (!recv_all(s, (char*)&header, sizeof(header)) || header.magic != dist_magic || header.payload_size > max_payload) return false;
+    payload.resize(header.payload_size);
+    return header.payload_size == 0 || recv_all(s, payload.data(), header.payload_size);
+}
+
+void write_coord(char* destination, long double value) {
+    ostringstream stream;
+    stream << setprecision(numeric_limits<long double>::max_digits10) << value;
+    strncpy(destination, stream.str().c_str(), dist_coord_digits - 1);
+    destination[dist_coord_digits - 1] = '\0';
+}
+
+long double read_coord(const char* source) {
+    return strtold(source, nullptr);
+}
+
+bool init_winsock() {
+    WSADATA wsa_data;
+    return WSAStartup(MAKEWORD(2, 2), &wsa_data) == 0;
+}
+
+void spawn_dist_worker(unsigned short port) {
+    char exe_path[MAX_PATH];
+    if (GetModuleFileNameA(NULL, exe_path, MAX_PATH) == 0) return;
+    string command = "\"" + string(exe_path) + "\" --worker 127.0.0.1 " + to_string(port);
+
+    STARTUPINFOA startup_info;
+    PROCESS_INFORMATION process_info;
+    ZeroMemory(&startup_info, sizeof(startup_info));
+    startup_info.cb = sizeof(startup_info);
+    ZeroMemory(&process_info, sizeof(process_info));
+    if (!CreateProcessA(NULL, &command[0], NULL, NULL, FALSE, CREATE_NO_WINDOW, NULL, NULL, &startup_info, &process_info)) {
+        cerr << "Could not start local render worker." << endl;
+        return;
+    }
+    CloseHandle(process_info.hThread);
+    CloseHandle(process_info.hProcess);
+}
+
+bool start_coordinator(unsigned short port, unsigned int local_workers) {
+    if (!init_winsock()) return false;
+    dist_listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (dist_listener == INVALID_SOCKET) return false;
+
+    sockaddr_in address;
+    ZeroMemory(&address, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (::bind(dist_listener, (sockaddr*)&address, sizeof(address)) == SOCKET_ERROR || listen(dist_listener, SOMAXCONN) == SOCKET_ERROR) {
+        cerr << "Could not listen on port " << port << " for render workers." << endl;
+        closesocket(dist_listener);
+        dist_listener = INVALID_SOCKET;
+        return false;
+    }
+    cout << "Waiting for render workers on port " << port << endl;
+    for (unsigned int i = 0; i < local_workers; i++) {
+        spawn_dist_worker(port);
+    }
+    use_distributed = true;
+    return true;
+}
+
+// The HELLO is read later by greet_dist_workers, accepting never waits for the peer
+void accept_dist_worker() {
+    SOCKET s = accept(dist_listener, NULL, NULL);
+    if (s == INVALID_SOCKET) return;
+    DWORD timeout = dist_recv_timeout_ms; // A peer which stops in the middle of a message can not block the window
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+    dist_greetings.push_back({ s, GetTickCount64() });
+}
+
+// Turns the connections with a valid HELLO in readable into workers, closes invalid and silent ones
+void greet_dist_workers(fd_set& readable) {
+    for (size_t i = 0; i < dist_greetings.size(); i++) {
+        DistGreeting greeting = dist_greetings[i];
+        bool ready = FD_ISSET(greeting.socket, &readable) != 0;
+        if (!ready && GetTickCount64() - greeting.accepted_at < dist_hello_timeout_ms) continue;
+        dist_greetings.erase(dist_greetings.begin() + i--);
+        DistHeader header;
+        vector<char> payload;
+        if (!ready || !recv_message(greeting.socket, header, payload, 0) || header.type != DIST_HELLO || header.job != dist_version) {
+            closesocket(greeting.socket);
+            continue;
+        }
+        dist_workers.push_back({ greeting.socket, true, -1, 0 });
+        cout << "Render worker connected (" << dist_workers.size() << " total)" << endl;
+    }
+}
+
+// Adds the listener and the connections waiting for their HELLO to readable
+void watch_dist_greetings(fd_set& readable) {
+    FD_SET(dist_listener, &readable);
+    for (DistGreeting& greeting : dist_greetings) FD_SET(greeting.socket, &readable);
+}
+
+// Picks up workers which connected while no frame was rendered
+void accept_pending_dist_workers() {
+    while (true) {
+        fd_set readable;
+        FD_ZERO(&readable);
+        watch_dist_greetings(readable);
+        timeval no_wait = { 0, 0 };
+        int ready = select(0, &readable, NULL, NULL, &no_wait);
+        if (ready < 0) return;
+        if (ready > 0 && FD_ISSET(dist_listener, &readable)) accept_dist_worker();
+        greet_dist_workers(readable);
+        if (ready == 0) return;
+    }
+}
+
+template <typename T>
+bool render_distributed(MandelArea<T>& area) {
+    if (dist_listener == INVALID_SOCKET) return false;
+    accept_pending_dist_workers();
+    if (dist_workers.empty()) return false;
+
+    dist_job++;
+    DistView view;
+    write_coord(view.x_start, area.x_start);
+    write_coord(view.x_end, area.x_end);
+    write_coord(view.y_start, area.y_start);
+    write_coord(view.y_end, area.y_end);
+    view.ratio = area.ratio;
+    view.width = area.width;
+    view.intensity = area.intensity;
+    view.magnification = area.magnification;
+    view.max_iter = area.max_iter;
+    view.kernel = area.kernel;
+
+    int n_tiles = (area.height + dist_tile_rows - 1) / dist_tile_rows;
+    deque<int> pending;
+    for (int i = 0; i < n_tiles; i++) pending.push_back(i);
+    vector<bool> done(n_tiles, false);
+    int done_tiles = 0;
+    // The first tiles may take what their cost suggests, later ones a multiple of the slowest so far. Every timeout
+    // doubles the limit, so a tile which is just slow is not taken from one worker after the other.
+    double cost = (double)area.width * dist_tile_rows * area.max_iter / dist_reference_cost;
+    ULONGLONG tile_timeout = max(dist_tile_timeout_ms, (ULONGLONG)(dist_tile_timeout_ms * cost));
+
+    auto dispatch = [&](DistWorker& worker) {
+        while (!pending.empty() && done[pending.front()]) pending.pop_front();
+        if (pending.empty()) return true;
+        int tile = pending.front();
+        DistHeader header = { 0, DIST_JOB, dist_job, (unsigned int)tile, (unsigned int)(tile * dist_tile_rows), (unsigned int)dist_tile_rows, sizeof(view) };
+        if (!send_message(worker.socket, header, &view)) return false;
+        pending.pop_front();
+        worker.idle = false;
+        worker.tile = tile;
+        worker.assigned_at = GetTickCount64();
+        return true;
+    };
+    auto drop = [&](size_t i) {
+        DistWorker& worker = dist_workers[i];
+        if (!worker.idle && !done[worker.tile]) pending.push_front(worker.tile);
+        closesocket(worker.socket);
+        dist_workers.erase(dist_workers.begin() + i);
+        cerr << "Lost a render worker, " << dist_workers.size() << " left." << endl;
+    };
+
+    cout << endl << "Calculating Mandelbrot on " << dist_workers.size() << " remote workers." << endl;
+    while (done_tiles < n_tiles && !dist_workers.empty()) {
+        for (size_t i = 0; i < dist_workers.size(); i++) {
+            if (dist_workers[i].idle && !dispatch(dist_workers[i])) drop(i--);
+        }
+
+        fd_set readable;
+        FD_ZERO(&readable);
+        watch_dist_greetings(readable);
+        for (DistWorker& worker : dist_workers) FD_SET(worker.socket, &readable);
+        timeval timeout = { 0, 100000 };
+        if (select(0, &readable, NULL, NULL, &timeout) == SOCKET_ERROR) break;
+
+        if (FD_ISSET(dist_listener, &readable)) accept_dist_worker();
+        size_t n_workers = dist_workers.size();
+        greet_dist_workers(readable); // New workers are appended and picked up in the next round
+        for (size_t i = 0; i < n_workers; i++) {
+            DistWorker& worker = dist_workers[i];
+            if (!FD_ISSET(worker.socket, &readable)) {
+                if (!worker.idle && GetTickCount64() - worker.assigned_at > tile_timeout) {
+                    cerr << "Tile " << worker.tile << " took longer than " << tile_timeout / 1000 << " s." << endl;
+                    tile_timeout *= 2;
+                    drop(i--);
+                    n_workers--;
+                }
+                continue;
+            }
+            DistHeader header;
+            vector<char> payload;
+            size_t expected = (size_t)area.width * dist_tile_rows * sizeof(unsigned int);
+            if (!recv_message(worker.socket, header, payload, expected) || header.type != DIST_RESULT) {
+                drop(i--);
+                n_workers--;
+                continue;
+            }
+            if (!worker.idle) tile_timeout = max(tile_timeout, dist_timeout_factor * (GetTickCount64() - worker.assigned_at));
+            worker.idle = true;
+            if (header.job != dist_job || (int)header.tile >= n_tiles || done[header.tile]) continue;
+
+            const unsigned int* counts = (const unsigned int*)payload.data();
+            int first_row = header.tile * dist_tile_rows;
+            int n_rows = min(dist_tile_rows, area.height - first_row);
+            if (payload.size() != (size_t)n_rows * area.width * sizeof(unsigned int)) {
+                drop(i--);
+                n_workers--;
+                continue;
+            }
+            memcpy(&area.iterations[(size_t)first_row * area.width], counts, payload.size());
+            done[header.tile] = true;
+            done_tiles++;
+            show_progress_bar((float)done_tiles / (float)n_tiles);
+        }
+    }
+
+    // Every worker is gone, the rest of the frame is rendered here on all cores
+    if (done_tiles < n_tiles) {
+        cerr << "No render workers left, calculating " << n_tiles - done_tiles << " tiles locally." << endl;
+        vector<int> local_tiles;
+        for (int i = 0; i < n_tiles; i++) {
+            if (!done[i]) local_tiles.push_back(i);
+        }
+        int n_local = (int)local_tiles.size();
+        get_render_pool().parallel_for(n_local, [&](int i) {
+            int tile = local_tiles[i];
+            area.calculate_iterations(tile * dist_tile_rows, dist_tile_rows, &area.iterations[(size_t)tile * dist_tile_rows * area.width]);
+        }, [n_local](int finished) { show_progress_bar((float)finished / (float)n_local); });
+    }
+    return true;
+}
+
+SOCKET connect_to_coordinator(const string& host, unsigned short port) {
+    addrinfo hints;
+    addrinfo* result = nullptr;
+    ZeroMemory(&hints, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    if (getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &result) != 0) return INVALID_SOCKET;
+    SOCKET s = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if (s != INVALID_SOCKET && connect(s, result->ai_addr, (int)result->ai_addrlen) == SOCKET_ERROR) {
+        closesocket(s);
+        s = INVALID_SOCKET;
+    }
+    freeaddrinfo(result);
+    return s;
+}
+
+template <typename T>
+int run_dist_worker(const string& host, unsigned short port) {
+    if (!init_winsock()) return 1;
+    while (true) {
+        SOCKET s = connect_to_coordinator(host, port);
+        if (s == INVALID_SOCKET) {
+            Sleep(dist_reconnect_ms);
+            continue;
+        }
+        cout << "Connected to coordinator " << host << ":" << port << endl;
+        DistHeader hello = { 0, DIST_HELLO, dist_version, 0, 0, 0, 0 };
+        send_message(s, hello, nullptr);
+
+        unsigned int area_job = 0;
+        MandelArea<T>* area = nullptr;
+        DistHeader header;
+        vector<char> payload;
+        vector<unsigned int> iterations;
+        while (recv_message(s, header, payload, sizeof(DistView))) {
+            if (header.type != DIST_JOB || payload.size() != sizeof(DistView)) break;
+            DistView* view = (DistView*)payload.data();
+            if (view->kernel != kernel_escape_time && view->kernel != kernel_perturbation) {
+                cerr << "Unknown kernel " << view->kernel << " requested." << endl;
+                break;
+            }
+            if (area == nullptr || area_job != header.job) {
+                delete area;
+                area = new MandelArea<T>(read_coord(view->x_start), read_coord(view->x_end), read_coord(view->y_start), read_coord(view->y_end), view->ratio, view->width, view->intensity, view->magnification, false);
+                area->max_iter = view->max_iter;
+                area->kernel = view->kernel;
+                area->prepare_kernel();
+                area_job = header.job;
+            }
+            int n_rows = min((int)header.n_rows, area->height - (int)header.first_row);
+            if (n_rows <= 0) break;
+            iterations.resize((size_t)n_rows * area->width);
+            area->calculate_iterations(header.first_row, n_rows, iterations.data());
+
+            DistHeader result = { 0, DIST_RESULT, header.job, header.tile, header.first_row, (unsigned int)n_rows, (unsigned int)(iterations.size() * sizeof(unsigned int)) };
+            if (!send_message(s, result, iterations.data())) break;
+        }
+        delete area;
+        closesocket(s);
+        cerr << "Connection to coordinator lost, reconnecting..." << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include "ZoomVideo.h"
+
+// Exponential map zoom videos. The target is rendered once on a log-polar strip: every column is an angle, every row
+// a radius, and the radius grows by the same factor from row to row. The strip reaches from half a pixel of the
+// deepest frame to the corners of the first one, so every frame of a zoom centered on the target is a resampling of
+// it. For a corner radius of r pixels the strip has about 2 pi r^2 ln(zoom) samples, whatever the number of frames.
+
+float expmap_density = 1.f; // Strip samples per frame pixel along the circle through the frame corners
+const int expmap_check_frames = 5; // Frames also rendered directly for the PSNR of the strip
+
+struct ExpMapStrip {
+    Mat colors; // 8-bit BGR, column n_angles repeats column 0 for the interpolation
+    int n_angles;
+    double log_min; // ln of the radius of row 0, in pixels of the first frame
+    double log_step;
+    unsigned int max_iter;
+};
+
+template <typename T>
+ExpMapStrip render_expmap_strip(complex<long double> target, long double magnification, float intensity) {
+    const ZoomView home = home_zoom_view();
+    int height = (int)(video_width / aspect_ratio);
+    ExpMapStrip strip;
+    double corner = sqrt(video_width * video_width / 4. + height * height / 4.);
+    strip.n_angles = (int)ceil(2 * CV_PI * corner * expmap_density);
+    strip.log_step = 2 * CV_PI / strip.n_angles;
+    strip.log_min = log(0.5 / (double)magnification);
+    int n_rows = (int)ceil((log(corner) - strip.log_min) / strip.log_step) + 2;
+
+    // The deepest frame sets max_iter and the reference orbit, the perturbation kernel rebases outer samples.
+    // Samples are offsets in its pixels from the target at its center, so they never go through absolute coordinates.
+    long double x_dist = home.x_dist / magnification;
+    long double y_dist = home.y_dist / magnification;
+    MandelArea<T> area(target.real() - x_dist / 2, target.real() + x_dist / 2, target.imag() + y_dist / 2, target.imag() - y_dist / 2,
+        aspect_ratio, video_width, intensity, max(1ULL, (unsigned long long)magnification), false);
+    area.equalize = false;
+    area.prepare_kernel();
+    strip.max_iter = area.max_iter;
+    long double x_unit = home.x_dist / video_width / area.x_per_px; // Pixels of the deepest frame per pixel of the first
+    long double y_unit = home.y_dist / height / area.y_per_px;
+    long double center_x = (target.real() - area.x_start) / area.x_per_px;
+    long double center_y = (area.y_start - target.imag()) / area.y_per_px;
+    cout << "Rendering the " << strip.n_angles << "x" << n_rows << " strip (" << setprecision(3) << (double)strip.n_angles * n_rows / ((double)video_width * height)
+        << " frames of samples, max_iter=" << strip.max_iter << ")" << endl;
+
+    vector<unsigned int> counts((size_t)n_rows * strip.n_angles);
+    const int rows_per_task = 16;
+    int n_bands = (n_rows + rows_per_task - 1) / rows_per_task;
+    get_render_pool().parallel_for(n_bands, [&](int band) {
+        int last_row = min((band + 1) * rows_per_task, n_rows);
+        for (int row = band * rows_per_task; row < last_row; row++) {
+            long double radius = expl(strip.log_min + row * strip.log_step);
+            for (int column = 0; column < strip.n_angles; column++) {
+                long double angle = column * 2 * CV_PI / strip.n_angles;
+                complex<long double> z = 0;
+                unsigned int counter = 0;
+                counts[(size_t)row * strip.n_angles + column] = area.pixel_iter_nr(center_x + radius * cosl(angle) * x_unit, center_y - radius * sinl(angle) * y_unit, z, counter);
+            }
+        }
+    }, [n_bands](int finished) { show_progress_bar((float)finished / n_bands); });
+
+    vector<uchar> lut = MandelArea<T>::template scaled_lut<uchar>(area.palette_lut(), 255.f);
+    strip.colors.create(n_rows, strip.n_angles + 1, CV_8UC3);
+    for (int row = 0; row < n_rows; row++) {
+        uchar* data = strip.colors.ptr<uchar>(row);
+        for (int column = 0; column <= strip.n_angles; column++, data += n_channels) {
+            const uchar* color = &lut[n_channels * (size_t)min(counts[(size_t)row * strip.n_angles + column % strip.n_angles], strip.max_iter)];
+            data[0] = color[0];
+            data[1] = color[1];
+            data[2] = color[2];
+        }
+    }
+    return strip;
+}
+
+// Renders the zoom onto target down to the magnification from the strip, returns the process exit code
+template <typename T>
+int render_expmap_video(complex<long double> target, long double magnification, const string& output, float intensity) {
+    if (!(magnification > 1)) {
+        cerr << "The magnification has to be greater than 1, the strip reaches from the deepest frame out to the first one." << endl;
+        return 1;
+    }
+    histogram_coloring = false; // The strip has no frame to take the histogram of, the checks have to match it
+    const ZoomView home = home_zoom_view();
+    int height = (int)(video_width / aspect_ratio);
+    vector<ZoomView> frames;
+    int n_frames = max(2, (int)ceil(video_frames_per_2x * log2l(magnification)) + 1);
+    for (int frame = 0; frame < n_frames; frame++) {
+        long double scale = powl(magnification, -(long double)frame / (n_frames - 1));
+        frames.push_back({ target.real(), target.imag(), home.x_dist * scale, home.y_dist * scale });
+    }
+    VideoOutput video;
+    if (!video.open(output, Size(video_width, height))) return 1;
+
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    ExpMapStrip strip = render_expmap_strip<T>(target, magnification, intensity);
+    chrono::steady_clock::time_point strip_end = chrono::steady_clock::now();
+
+    // Strip coordinates of every frame pixel in the first frame, deeper frames only move down by ln(scale) / log_step
+    Mat map_x(height, video_width, CV_32FC1);
+    Mat base_y(height, video_width, CV_32FC1);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < video_width; x++) {
+            double dx = x - video_width / 2.;
+            double dy = height / 2. - y;
+            double angle = atan2(dy, dx);
+            if (angle < 0) angle += 2 * CV_PI;
+            map_x.at<float>(y, x) = (float)(angle / (2 * CV_PI) * strip.n_angles);
+            base_y.at<float>(y, x) = (float)((log(max(0.5, sqrt(dx * dx + dy * dy))) - strip.log_min) / strip.log_step);
+        }
+    }
+    vector<int> checks;
+    vector<Mat> synthesized;
+    for (int i = 0; i < expmap_check_frames; i++) checks.push_back((int)((long long)(n_frames - 1) * i / max(1, expmap_check_frames - 1)));
+    checks.erase(unique(checks.begin(), checks.end()), checks.end());
+    Mat map_y, image;
+    for (int frame = 0; frame < n_frames; frame++) {
+        double offset = log((double)(frames[frame].x_dist / home.x_dist)) / strip.log_step;
+        base_y.convertTo(map_y, CV_32FC1, 1., offset);
+        remap(strip.colors, image, map_x, map_y, INTER_LINEAR, BORDER_REPLICATE);
+        video.write(image);
+        if (find(checks.begin(), checks.end(), frame) != checks.end()) synthesized.push_back(image.clone());
+        show_progress_bar((float)(frame + 1) / n_frames);
+    }
+    video.close();
+    chrono::steady_clock::time_point end = chrono::steady_clock::now();
+    double strip_seconds = chrono::duration<double>(strip_end - begin).count();
+    double seconds = chrono::duration<double>(end - begin).count();
+    cout << "Strip in " << setprecision(4) << strip_seconds << " s, " << n_frames << " frames in " << seconds << " s (" << n_frames / seconds << " fps)" << endl;
+
+    vector<ZoomView> check_views;
+    for (int frame : checks) check_views.push_back(frames[frame]);
+    compare_to_direct<T>(synthesized, check_views, checks, intensity, strip.max_iter, n_frames, seconds);
+    return 0;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <filesystem>
+#include <functional>
+#include <string>
+
+using namespace std;
+
+// File helpers shared by the tile cache, the home view cache and the render daemon
+
+const char* const disk_cache_dir = "cache/";
+
+// FNV-1a
+unsigned int checksum(const void* data, size_t size) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Writes to a temporary file next to the target and renames it, so readers never see a half written file
+bool write_atomically(const filesystem::path& target, const function<bool(const string&)>& writer) {
+    filesystem::path temporary = target;
+    temporary.replace_filename(target.stem().string() + ".tmp" + target.extension().string());
+    if (!writer(temporary.string())) return false;
+    error_code error;
+    filesystem::rename(temporary, target, error);
+    return !error;
+}
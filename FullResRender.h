@@ -0,0 +1,95 @@
+#pragma once
+#include <atomic>
+#include "MellowSim.h"
+
+// With preview rendering, interactive frames are only as wide as the window. The hor_resolution frame of a view is
+// rendered here on threads with the lowest priority: from a zoom into it on, or when a picture is saved. Leaving the
+// view cancels it.
+
+template <typename T>
+class FullResRender {
+public:
+    ~FullResRender() {
+        cancel();
+    }
+
+    // The corners are compared to half a pixel of the full resolution frame, the spacings are rounded differently
+    bool matches(const MandelArea<T>& view, int width) const {
+        if (area == nullptr || area->width != width || area->max_iter != view.max_iter || area->kernel != view.kernel) return false;
+        long double tolerance = area->x_per_px / 2;
+        return fabsl(area->x_start - view.x_start) < tolerance && fabsl(area->y_start - view.y_start) < tolerance
+            && fabsl(area->x_per_px * width - view.x_per_px * view.width) < tolerance;
+    }
+
+    // Starts the frame of view with the given width, unless it is running or done already
+    void start(const MandelArea<T>& view, int width) {
+        if (matches(view, width)) return;
+        cancel();
+        long double x_end = view.x_start + view.width * view.x_per_px;
+        long double y_end = view.y_start - view.height * view.y_per_px;
+        area = new MandelArea<T>(view.x_start, x_end, view.y_start, y_end, view.ratio, width, view.intensity, view.magnification, false);
+        area->max_iter = view.max_iter;
+        area->kernel = view.kernel;
+        area->palette = view.palette;
+        area->hue_shift = view.hue_shift;
+        area->equalize = view.equalize;
+        area->track_smooth = view.track_smooth;
+        area->supersample = false; // hor_resolution is sampled finely enough
+        area->iterations.assign(area->px_count, 0);
+        if (area->track_smooth) area->smooth.assign(area->px_count, 0.f);
+        area->prepare_kernel();
+        cancelled = false;
+        next_row = 0;
+        finished_rows = 0;
+        unsigned int n_threads = max(1u, thread::hardware_concurrency());
+        for (unsigned int i = 0; i < n_threads; i++) {
+            threads.push_back(thread([this] { work(); }));
+        }
+        cout << "Rendering the " << width << " px frame in the background" << endl;
+    }
+
+    void cancel() {
+        cancelled = true;
+        for (thread& t : threads) t.join();
+        threads.clear();
+        delete area;
+        area = nullptr;
+    }
+
+    bool done() const {
+        return area != nullptr && finished_rows == area->height;
+    }
+
+    // Blocks until the frame is finished, nullptr if nothing was started
+    MandelArea<T>* finish() {
+        if (area == nullptr) return nullptr;
+        while (!done()) {
+            show_progress_bar((float)finished_rows / area->height);
+            this_thread::sleep_for(chrono::milliseconds(100));
+        }
+        show_progress_bar(1.f);
+        return area;
+    }
+
+private:
+    MandelArea<T>* area = nullptr;
+    vector<thread> threads;
+    atomic<bool> cancelled{ false };
+    atomic<int> next_row{ 0 };
+    atomic<int> finished_rows{ 0 };
+
+    void work() {
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+        bool keep_smooth = area->smooth.size() == (size_t)area->px_count;
+        int y;
+        while (!cancelled && (y = next_row++) < area->height) {
+            size_t px = (size_t)y * area->width;
+            for (int x = 0; x < area->width; x++, px++) {
+                complex<long double> z = 0;
+                unsigned int counter = 0;
+                area->iterations[px] = area->pixel_iter_nr(x, y, z, counter, keep_smooth ? &area->smooth[px] : nullptr);
+            }
+            finished_rows++;
+        }
+    }
+};
@@ -0,0 +1,176 @@
+#pragma once
+#include <atomic>
+#include "MellowSim.h"
+#include "FileUtil.h"
+
+// Iteration counts of the home view, so later launches show the window without rendering it first.
+// cache/home_<width>x<height>_<max_iter>_k<kernel>.bin is memory-mapped on startup. A background thread then checks
+// the file against a few freshly iterated rows; if they differ it renders the view again and replaces the file.
+
+const unsigned int home_cache_magic = 0x4D534856; // "MSHV"
+const unsigned int home_cache_version = 1; // Increase when a kernel changes its results
+const int home_check_row_step = 64; // Every n-th row is iterated again to validate the file
+
+#pragma pack(push, 1)
+struct HomeCacheHeader {
+    unsigned int magic;
+    unsigned int version;
+    int width;
+    int height;
+    unsigned int max_iter;
+    unsigned int kernel;
+    double x_start;
+    double y_start;
+    double x_per_px;
+    double y_per_px;
+    unsigned int checksum; // Of the iteration counts following the header
+};
+#pragma pack(pop)
+
+mutex home_refresh_mutex;
+vector<unsigned int> home_refresh; // Counts rendered again by the background check
+HomeCacheHeader home_refresh_header; // View they belong to
+atomic<bool> home_refreshed(false);
+thread home_check; // The background check, joined by stop_home_check before exit or the next check
+atomic<bool> home_check_stop(false);
+
+template <typename T>
+string home_cache_path(const MandelArea<T>& area) {
+    return string(disk_cache_dir) + "home_" + to_string(area.width) + "x" + to_string(area.height) + "_" + to_string(area.max_iter) + "_k" + to_string(area.kernel) + ".bin";
+}
+
+template <typename T>
+HomeCacheHeader home_cache_header(const MandelArea<T>& area) {
+    HomeCacheHeader header = { home_cache_magic, home_cache_version, area.width, area.height, area.max_iter, area.kernel,
+        (double)area.x_start, (double)area.y_start, (double)area.x_per_px, (double)area.y_per_px, 0 };
+    return header;
+}
+
+// Copies the counts from the mapped file if its header matches the view, the checksum is left to the background check
+template <typename T>
+bool load_home_view(MandelArea<T>& area, unsigned int& stored_checksum) {
+    HANDLE file = CreateFileA(home_cache_path(area).c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    size_t data_size = (size_t)area.px_count * sizeof(unsigned int);
+    LARGE_INTEGER file_size;
+    HANDLE mapping = NULL;
+    char* view = nullptr;
+    if (GetFileSizeEx(file, &file_size) && (unsigned long long)file_size.QuadPart == sizeof(HomeCacheHeader) + data_size) {
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping != NULL) view = (char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+    bool loaded = false;
+    if (view != nullptr) {
+        HomeCacheHeader expected = home_cache_header(area);
+        HomeCacheHeader* header = (HomeCacheHeader*)view;
+        if (memcmp(header, &expected, offsetof(HomeCacheHeader, checksum)) == 0) {
+            const unsigned int* counts = (const unsigned int*)(view + sizeof(HomeCacheHeader));
+            area.iterations.assign(counts, counts + area.px_count);
+            stored_checksum = header->checksum;
+            loaded = true;
+        }
+        UnmapViewOfFile(view);
+    }
+    if (mapping != NULL) CloseHandle(mapping);
+    CloseHandle(file);
+    return loaded;
+}
+
+template <typename T>
+void save_home_view(const MandelArea<T>& area, const vector<unsigned int>& counts) {
+    CreateDirectory(disk_cache_dir, NULL);
+    HomeCacheHeader header = home_cache_header(area);
+    header.checksum = checksum(counts.data(), counts.size() * sizeof(unsigned int));
+    bool written = write_atomically(home_cache_path(area), [&](const string& path) {
+        ofstream file(path, ios::binary | ios::trunc);
+        file.write((const char*)&header, sizeof(header));
+        file.write((const char*)counts.data(), counts.size() * sizeof(unsigned int));
+        return (bool)file;
+    });
+    if (!written) cerr << "Could not write " << home_cache_path(area) << endl;
+}
+
+// Runs on a low priority thread with its own copy of the view, so the window stays responsive
+template <typename T>
+void revalidate_home_view(MandelArea<T>* area, vector<unsigned int> counts, unsigned int stored_checksum) {
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+    area->prepare_kernel();
+    bool valid = checksum(counts.data(), counts.size() * sizeof(unsigned int)) == stored_checksum;
+    vector<unsigned int> row(area->width);
+    for (int y = 0; valid && y < area->height && !home_check_stop; y += home_check_row_step) {
+        area->calculate_iterations(y, 1, row.data());
+        valid = memcmp(row.data(), &counts[(size_t)y * area->width], row.size() * sizeof(unsigned int)) == 0;
+    }
+    if (home_check_stop) {
+        delete area;
+        return;
+    }
+    if (valid) {
+        cout << "Home view cache validated." << endl;
+    }
+    else {
+        cout << "Home view cache is outdated, rendering it again in the background." << endl;
+        for (int y = 0; y < area->height; y++) {
+            if (home_check_stop) {
+                delete area;
+                return;
+            }
+            area->calculate_iterations(y, 1, &counts[(size_t)y * area->width]);
+        }
+        save_home_view(*area, counts);
+        lock_guard<mutex> lock(home_refresh_mutex);
+        home_refresh.swap(counts);
+        home_refresh_header = home_cache_header(*area);
+        home_refreshed = true;
+    }
+    delete area;
+}
+
+// Cancels the background check and waits for it, a half rendered view is not stored
+void stop_home_check() {
+    if (!home_check.joinable()) return;
+    home_check_stop = true;
+    home_check.join();
+    home_check_stop = false;
+}
+
+// Shows the home view from the cache file if there is one for it, renders and stores it otherwise
+template <typename T>
+void show_home_view(MandelArea<T>& area) {
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    unsigned int stored_checksum = 0;
+    if (area.track_smooth || !load_home_view(area, stored_checksum)) {
+        area.render();
+        if (!area.track_smooth) save_home_view(area, area.iterations);
+        return;
+    }
+    area.colorize();
+    area.show();
+    chrono::steady_clock::time_point end = chrono::steady_clock::now();
+    cout << "Home view loaded from " << home_cache_path(area) << " in " << chrono::duration_cast<chrono::milliseconds>(end - begin).count() << "[ms]" << endl;
+
+    MandelArea<T>* check = new MandelArea<T>(area.x_start, area.x_start + area.width * area.x_per_px, area.y_start, area.y_start - area.height * area.y_per_px, area.ratio, area.width, area.intensity, area.magnification, false);
+    // Exactly the same grid, the constructor could round the spacing differently
+    check->x_start = area.x_start;
+    check->y_start = area.y_start;
+    check->x_per_px = area.x_per_px;
+    check->y_per_px = area.y_per_px;
+    check->max_iter = area.max_iter;
+    check->kernel = area.kernel;
+    stop_home_check();
+    home_check = thread(revalidate_home_view<T>, check, area.iterations, stored_checksum);
+}
+
+// Takes over the counts of the background check if they are ready and still belong to the shown view
+template <typename T>
+bool take_home_refresh(MandelArea<T>& area) {
+    if (!home_refreshed) return false;
+    lock_guard<mutex> lock(home_refresh_mutex);
+    home_refreshed = false;
+    HomeCacheHeader expected = home_cache_header(area);
+    if (home_refresh.size() != (size_t)area.px_count || memcmp(&home_refresh_header, &expected, offsetof(HomeCacheHeader, checksum)) != 0) return false;
+    area.iterations.swap(home_refresh);
+    vector<unsigned int>().swap(home_refresh);
+    area.colorize();
+    return true;
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include "ZoomVideo.h"
+
+// Keyframe zoom videos. Only every 2x zoom onto the target is rendered, keyframe_oversampling times wider than the
+// video. A frame between keyframe k and k + 1 is the center crop of k scaled down to the video size; in the middle,
+// where k + 1 reaches, k + 1 is blended in with the share of the way to it. Higher oversampling keeps more detail in
+// the crops, at the square of its cost per keyframe.
+
+float keyframe_oversampling = 2.f;
+
+// Keyframe k shows the target at 1 / 2^k of the first frame's width
+template <typename T>
+Mat render_keyframe(complex<long double> target, int k, unsigned int max_iter, float intensity) {
+    const ZoomView home = home_zoom_view();
+    long double scale = ldexpl(1.L, -k);
+    long double x_dist = home.x_dist * scale;
+    long double y_dist = home.y_dist * scale;
+    MandelArea<T> area(target.real() - x_dist / 2, target.real() + x_dist / 2, target.imag() + y_dist / 2, target.imag() - y_dist / 2,
+        aspect_ratio, (int)(video_width * keyframe_oversampling), intensity, 1ULL << min(k, 63), false);
+    area.equalize = false;
+    area.max_iter = max_iter;
+    area.compute();
+    return area.output_image(CV_8U).clone();
+}
+
+// The part of key which shows zoom times less than the key itself, scaled to size
+Mat crop_keyframe(const Mat& key, long double zoom, Size size) {
+    double factor = (double)(zoom * key.cols / size.width); // Key pixels per frame pixel
+    Mat transform = (Mat_<double>(2, 3) << 1. / factor, 0., size.width / 2. - key.cols / 2. / factor,
+        0., 1. / factor, size.height / 2. - key.rows / 2. / factor);
+    Mat frame;
+    warpAffine(key, frame, transform, size, INTER_LINEAR, BORDER_REPLICATE);
+    return frame;
+}
+
+// Renders the zoom onto target down to the magnification from keyframes, returns the process exit code
+template <typename T>
+int render_keyframe_video(complex<long double> target, long double magnification, const string& output, float intensity) {
+    if (!(magnification > 1)) {
+        cerr << "The magnification has to be greater than 1, there is no 2x zoom to take keyframes of." << endl;
+        return 1;
+    }
+    histogram_coloring = false; // Keyframes of different depths have to share their colors
+    const ZoomView home = home_zoom_view();
+    Size size(video_width, (int)(video_width / aspect_ratio));
+    int n_frames = max(2, (int)ceil(video_frames_per_2x * log2l(magnification)) + 1);
+    int n_keys = max(2, (int)ceil(log2l(magnification)) + 1);
+    // Every keyframe uses the limit of the deepest one, so the palette does not jump between them
+    long double x_dist = home.x_dist / magnification;
+    long double y_dist = home.y_dist / magnification;
+    MandelArea<T> deepest(target.real() - x_dist / 2, target.real() + x_dist / 2, target.imag() + y_dist / 2, target.imag() - y_dist / 2,
+        aspect_ratio, size.width, intensity, max(1ULL, (unsigned long long)magnification), false);
+    unsigned int max_iter = deepest.max_iter;
+    VideoOutput video;
+    if (!video.open(output, size)) return 1;
+    cout << "Rendering " << n_keys << " keyframes of " << (int)(size.width * keyframe_oversampling) << " px for " << n_frames << " frames" << endl;
+
+    vector<int> checks = { 0, n_frames / 3, n_frames / 2, 2 * n_frames / 3, n_frames - 1 }; // Frames compared to direct rendering
+    checks.erase(unique(checks.begin(), checks.end()), checks.end());
+    vector<Mat> synthesized;
+    vector<ZoomView> check_views;
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    double key_seconds = 0;
+    int loaded = -1; // keys[0] is keyframe loaded, keys[1] the next one
+    Mat keys[2];
+    for (int frame = 0; frame < n_frames; frame++) {
+        long double depth = log2l(magnification) * frame / (n_frames - 1); // In 2x zooms
+        int k = min((int)depth, n_keys - 2);
+        long double t = depth - k;
+        if (loaded != k) {
+            chrono::steady_clock::time_point key_begin = chrono::steady_clock::now();
+            keys[0] = loaded >= 0 && loaded == k - 1 ? keys[1] : render_keyframe<T>(target, k, max_iter, intensity);
+            keys[1] = render_keyframe<T>(target, k + 1, max_iter, intensity);
+            loaded = k;
+            key_seconds += chrono::duration<double>(chrono::steady_clock::now() - key_begin).count();
+        }
+        long double zoom = powl(2.L, -t);
+        Mat image = crop_keyframe(keys[0], zoom, size);
+        if (t > 0) {
+            Mat inner = crop_keyframe(keys[1], 2 * zoom, size);
+            int inner_width = (int)floor(size.width / (2 * zoom));
+            int inner_height = (int)floor(size.height / (2 * zoom));
+            Rect roi((size.width - inner_width) / 2, (size.height - inner_height) / 2, inner_width, inner_height);
+            addWeighted(image(roi), (double)(1 - t), inner(roi), (double)t, 0., image(roi));
+        }
+        video.write(image);
+        if (find(checks.begin(), checks.end(), frame) != checks.end()) {
+            long double scale = powl(2.L, -depth);
+            synthesized.push_back(image);
+            check_views.push_back({ target.real(), target.imag(), home.x_dist * scale, home.y_dist * scale });
+        }
+        show_progress_bar((float)(frame + 1) / n_frames);
+    }
+    video.close();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    cout << n_keys << " keyframes (oversampling " << keyframe_oversampling << ") in " << setprecision(4) << key_seconds << " s, " << n_frames << " frames in " << seconds << " s (" << n_frames / seconds << " fps)" << endl;
+    compare_to_direct<T>(synthesized, check_views, checks, intensity, max_iter, n_frames, seconds);
+    return 0;
+}
@@ -10,9 +10,19 @@
 #include <opencv2/core/utils/logger.hpp>
 #include <chrono>
 #include <limits>
-#include <stack>
 #include <filesystem>
 #include "MellowSim.h"
+#include "SharedRender.h"
+#include "Distributed.h"
+#include "RenderDaemon.h"
+#include "TileCache.h"
+#include "ZoomHistory.h"
+#include "HomeCache.h"
+#include "FullResRender.h"
+#include "PaletteCycle.h"
+#include "ZoomVideo.h"
+#include "ExpMapVideo.h"
+#include "KeyframeVideo.h"
 
 
 using namespace std;
@@ -28,10 +38,25 @@ float min_zoom = 0.05;
 float max_zoom = 0.95;
 unsigned long long magnification = 1;
 float intensity = 2.;
+const unsigned short hue_shift_step = 30;
+bool snap_to_parent = false; // Snap zooms to the parent's pixel grid to reuse its iteration counts
 
 const int hor_resolution = 2048;
 const int ver_resolution = hor_resolution / aspect_ratio;
 
+// Preview frames and frames with adaptive anti-aliasing have one sample per window pixel instead of being rendered
+// at hor_resolution
+int frame_width() {
+    return adaptive_aa || preview_rendering ? w_width : hor_resolution;
+}
+
+const int pan_step = w_width / 8; // Window pixels per arrow key press
+bool panning = false;
+int pan_anchor_x = 0;
+int pan_anchor_y = 0;
+float pan_residual_x = 0; // Frame pixels which are not applied yet
+float pan_residual_y = 0;
+
 int prev_x = -1;
 int prev_y = -1;
 int prev_z = 0;
@@ -40,7 +65,10 @@ int prev_z = 0;
 
 //typedef unsigned short T_IMG;
 typedef unsigned char T_IMG;
-stack<MandelArea<T_IMG>> st;
+ZoomHistory<T_IMG> st;
+bool root_is_home = true; // Zooming out of the root replaces it, zoomOut then brings the home view back
+FullResRender<T_IMG> full_res;
+PaletteCycle palette_cycle;
 
 
 inline std::tm localtime_xp(std::time_t timer)
@@ -59,7 +87,7 @@ inline std::tm localtime_xp(std::time_t timer)
 }
 
 // default = "YYYY-MM-DD HH:MM:SS"
-inline std::string time_stamp(const std::string& fmt = "%Y_%m_%d_%H_%M_%S") // "%F %T"
+inline std::string time_stamp(const std::string& fmt) // "%F %T"
 {
     auto bt = localtime_xp(std::time(0));
     char buf[64];
@@ -85,10 +113,75 @@ void show_progress_bar(float progress) {
 }
 
 
+// Pans the current view by a distance in window pixels. Only whole frame pixels are applied, the rest is carried
+// over to the next pan, so the view stays on its pixel grid. The home view is not moved, panning it continues on a
+// copy one level above, so a right click, zoomOut or a guided zoom still start from the home view.
+void pan_view(float window_dx, float window_dy) {
+    palette_cycle.stop();
+    MandelArea<T_IMG>& area = st.top();
+    float dx = window_dx * area.width / w_width + pan_residual_x;
+    float dy = window_dy * area.width / w_width + pan_residual_y;
+    int whole_x = (int)dx;
+    int whole_y = (int)dy;
+    pan_residual_x = dx - whole_x;
+    pan_residual_y = dy - whole_y;
+    if (whole_x == 0 && whole_y == 0) return;
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    if (st.size() == 1) st.push(MandelArea<T_IMG>(area));
+    st.top().pan(whole_x, whole_y);
+    st.top().show();
+    chrono::steady_clock::time_point end = chrono::steady_clock::now();
+    cout << "Panned by " << whole_x << ", " << whole_y << " px in " << chrono::duration_cast<chrono::milliseconds>(end - begin).count() << "[ms]" << endl;
+}
+
+// The first frame: the start view, on the tile lattice when the tile cache is on
+MandelArea<T_IMG> home_area() {
+    // Opens cache/tiles.bin before the first tiled frame, so a restart reports the tiles it will read from disk
+    if (use_tile_cache) get_disk_tile_cache();
+    return use_tile_cache
+        ? lattice_area<T_IMG>(0, llround(first_start_x / lattice_base_x), llround(-first_start_y / lattice_base_y), aspect_ratio, hor_resolution, intensity)
+        : MandelArea<T_IMG>(first_start_x, first_end_x, first_start_y, first_end_y, aspect_ratio, hor_resolution, intensity, 1, false);
+}
+
+// Zooming out of the root view: the current frame becomes the center of a k times larger view. Every k-th pixel of
+// the old frame is taken over, so mostly the ring around it is iterated.
+void zoom_out_of_root() {
+    MandelArea<T_IMG>& area = st.top();
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    bool tiled = use_tile_cache && area.level > 0;
+    int zoom_levels = tiled ? min(area.level, max(1, (int)round(log2(1. / zoom_factor)))) : 0;
+    int k = tiled ? 1 << zoom_levels : max(2, (int)round(1. / zoom_factor));
+    int offset_x = (area.width - area.width / k) / 2;
+    int offset_y = (area.height - area.height / k) / 2;
+    long double start_x = area.x_start - offset_x * k * area.x_per_px;
+    long double start_y = area.y_start + offset_y * k * area.y_per_px;
+    long long grid_x = floor_div(area.grid_x, k) - offset_x;
+    long long grid_y = floor_div(area.grid_y, k) - offset_y;
+    MandelArea<T_IMG> parent = tiled
+        ? lattice_area<T_IMG>(area.level - zoom_levels, grid_x, grid_y, aspect_ratio, hor_resolution, intensity)
+        : MandelArea<T_IMG>(start_x, start_x + area.width * k * area.x_per_px, start_y, start_y - area.height * k * area.y_per_px, aspect_ratio, area.width, intensity, max(1ULL, area.magnification / k), false);
+    // A view which got shifted onto the real axis no longer lies on the old pixel grid
+    if (tiled) parent.seed_from_child(area, (int)(area.grid_x - k * grid_x), (int)(area.grid_y - k * grid_y), k);
+    else if (fabsl(parent.y_start - start_y) < area.y_per_px / 1024) parent.seed_from_child(area, offset_x * k, offset_y * k, k);
+    parent.render();
+    magnification = parent.magnification;
+    st.replace_top(move(parent));
+    root_is_home = false;
+    chrono::steady_clock::time_point end = chrono::steady_clock::now();
+    cout << "Time elapsed = " << chrono::duration_cast<chrono::milliseconds>(end - begin).count() << "[ms]" << std::endl;
+    cout << "Magnification = " << magnification << endl;
+}
+
 Mat showing;
 bool showing_zoombox = true;
 void onChange(int event, int x, int y, int z, void*) {
-    MandelArea<T_IMG> area = st.top();
+    MandelArea<T_IMG>& area = st.top();
+
+    // Clicks end the palette cycling, the zoom box is not drawn over it
+    if (palette_cycle.active()) {
+        if (event != EVENT_LBUTTONDOWN && event != EVENT_RBUTTONDOWN) return;
+        palette_cycle.stop();
+    }
 
     x = x > w_width ? w_width : x;
     y = y > w_height ? w_height : y;
@@ -102,10 +195,27 @@ void onChange(int event, int x, int y, int z, void*) {
     if (corrected_y < 0) corrected_y = 0;
     if (corrected_y + zoom_height + 1 > w_height) corrected_y = w_height - zoom_height;
 
+    // Ctrl + drag pans the view instead of zooming
+    if (event == EVENT_LBUTTONDOWN && (z & EVENT_FLAG_CTRLKEY)) {
+        panning = true;
+        pan_anchor_x = x;
+        pan_anchor_y = y;
+        return;
+    }
+    if (panning) {
+        if (event == EVENT_MOUSEMOVE) {
+            pan_view((float)(pan_anchor_x - x), (float)(pan_anchor_y - y));
+            pan_anchor_x = x;
+            pan_anchor_y = y;
+        }
+        if (event == EVENT_LBUTTONUP) panning = false;
+        return;
+    }
+
     if (event == EVENT_MBUTTONDOWN) {
         showing_zoombox = !showing_zoombox;
         if (!showing_zoombox) {
-            imshow(w_name, area.img);
+            imshow(w_name, area.display);
         }
     }
 
@@ -124,35 +234,64 @@ void onChange(int event, int x, int y, int z, void*) {
 
     long double start_x, start_y;
     if (event == EVENT_LBUTTONDOWN) {
-        MandelArea<T_IMG> area2 = area; // TODO: Remove - Only for debugging
-        magnification /= zoom_factor;
-        start_x = area.x_start + corrected_x * area.x_dist / w_width;
-        start_y = area.y_start - corrected_y * area.y_dist / w_height;
-        long double end_x = start_x + zoom_width * area.x_dist / w_width;
-        long double end_y = start_y + zoom_height * area.y_dist / w_height;
         chrono::steady_clock::time_point begin = chrono::steady_clock::now();
-        st.push(MandelArea<T_IMG>(start_x, end_x, start_y, end_y, aspect_ratio, hor_resolution, intensity, magnification));
+        // The lattice is made for hor_resolution and ends at max_tile_level
+        int zoom_levels = max(1, (int)round(log2(1. / zoom_factor)));
+        bool tiled = use_tile_cache && area.level >= 0 && area.level + zoom_levels <= max_tile_level && frame_width() == hor_resolution;
+        if (snap_to_parent || tiled) {
+            // Zoom by an integer factor k and start on a parent pixel, so every k-th pixel is already known.
+            // Views in the tile pyramid zoom by powers of two to stay on its lattice.
+            int k = tiled ? 1 << zoom_levels : max(2, (int)round(1. / zoom_factor));
+            int span_x = area.width / k;
+            int span_y = area.height / k;
+            int offset_x = min(max(x * area.width / w_width - span_x / 2, 0), area.width - span_x);
+            int offset_y = min(max(y * area.height / w_height - span_y / 2, 0), area.height - span_y);
+            magnification *= k;
+            start_x = area.x_start + offset_x * area.x_per_px;
+            start_y = area.y_start - offset_y * area.y_per_px;
+            long double end_x = start_x + area.width * area.x_per_px / k;
+            long double end_y = start_y - area.height * area.y_per_px / k;
+            MandelArea<T_IMG> child = tiled
+                ? lattice_area<T_IMG>(area.level + zoom_levels, (area.grid_x + offset_x) * k, (area.grid_y + offset_y) * k, aspect_ratio, hor_resolution, intensity)
+                : MandelArea<T_IMG>(start_x, end_x, start_y, end_y, aspect_ratio, frame_width(), intensity, magnification, false);
+            if (child.width == area.width) child.seed_from_parent(area, offset_x, offset_y, k);
+            child.render();
+            st.push(move(child));
+        }
+        else {
+            magnification /= zoom_factor;
+            start_x = area.x_start + corrected_x * area.x_dist / w_width;
+            start_y = area.y_start - corrected_y * area.y_dist / w_height;
+            long double end_x = start_x + zoom_width * area.x_dist / w_width;
+            long double end_y = start_y + zoom_height * area.y_dist / w_height;
+            st.push(MandelArea<T_IMG>(start_x, end_x, start_y, end_y, aspect_ratio, frame_width(), intensity, magnification));
+        }
         chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
         cout << "Time elapsed = " << chrono::duration_cast<chrono::milliseconds>(end - begin).count() << "[ms]" << std::endl;
-        MandelArea<T_IMG> area = st.top();
+        MandelArea<T_IMG>& area = st.top();
         //blur(area.img, area.img, Size(3, 3), Point(-1,-1), 4);
         //GaussianBlur(area.img, area.img, Size(3, 3), 0.);
         //medianBlur(area.img, area.img, 3);
         cout << "Magnification = " << magnification << endl;
+        if (preview_rendering && area.width < hor_resolution) full_res.start(area, hor_resolution);
         waitKey(1);
-        imshow(w_name, area.img);
+        imshow(w_name, area.display);
     }
 
     if (event == EVENT_RBUTTONDOWN && st.size() > 1) {
         st.pop();
-        MandelArea<T_IMG> area = st.top();
+        MandelArea<T_IMG>& area = st.top();
         magnification = area.magnification;
         cout << "Magnification = " << magnification << endl;
+        imshow(w_name, area.display);
+    }
+    else if (event == EVENT_RBUTTONDOWN) {
+        zoom_out_of_root();
     }
 
     if (showing_zoombox && event == EVENT_MOUSEMOVE) {
         Rect rect(corrected_x, corrected_y, zoom_width, zoom_height);
-        area.img.copyTo(showing);
+        area.display.copyTo(showing);
 
         rectangle(showing, rect, cv::Scalar(0, area.color_depth, 0));
 
@@ -181,20 +320,46 @@ string get_most_recent_file(const string& directory) {
 }
 
 
+// Cancels the full resolution frame in the background once the shown view is a different one
+void update_full_res_render() {
+    if (!full_res.matches(st.top(), hor_resolution)) full_res.cancel();
+}
+
+// Saves the current view, previews are saved from their full resolution frame
+void save_picture() {
+    MandelArea<T_IMG>& area = st.top();
+    if (area.width >= hor_resolution) {
+        area.save(output_formats[output_format]);
+        return;
+    }
+    full_res.start(area, hor_resolution);
+    MandelArea<T_IMG>* full = full_res.finish();
+    full->intensity = area.intensity;
+    full->hue_shift = area.hue_shift;
+    full->palette = area.palette;
+    full->equalize = area.equalize;
+    full->colorize();
+    full->save(output_formats[output_format]);
+}
+
 void zoomOut() {
     while (st.size() > 1) {
         st.pop();
     }
-    MandelArea<T_IMG> area = st.top();
+    if (!root_is_home) {
+        MandelArea<T_IMG> home = home_area();
+        show_home_view(home);
+        st.replace_top(move(home));
+        root_is_home = true;
+    }
+    MandelArea<T_IMG>& area = st.top();
     magnification = area.magnification;
     cout << "Magnification = " << magnification << endl;
 }
 
 
 void startZoom(string filename) {
-    if (magnification > 1) {
-        zoomOut();
-    }
+    zoomOut();
     ifstream file;
     string zoom_folder = "zooms/";
     if (filename == "") {
@@ -255,11 +420,63 @@ void startZoom(string filename) {
     cout << "Number of zooms: " << zooms_count << endl;
 }
 
-int main() {
+int main(int argc, char** argv) {
     utils::logging::setLogLevel(utils::logging::LogLevel::LOG_LEVEL_SILENT);
+    _putenv_s("OPENCV_IO_ENABLE_OPENEXR", "1"); // The EXR codec is disabled by default
+    // --tile-cache [--coordinator ...] starts the window on the tile lattice, like pressing t
+    if (argc > 1 && string(argv[1]) == "--tile-cache") {
+        use_tile_cache = true;
+        argc--;
+        argv++;
+    }
+    if (argc > 1 && string(argv[1]) == "--shm-worker") {
+        return run_shm_worker<unsigned int>(); // Workers only iterate, the front end colors
+    }
+    if (argc > 2 && string(argv[1]) == "--worker") {
+        unsigned short port = argc > 3 ? (unsigned short)stoi(argv[3]) : dist_default_port;
+        return run_dist_worker<unsigned int>(argv[2], port);
+    }
+    if (argc > 2 && string(argv[1]) == "--daemon") {
+        return run_render_daemon<T_IMG>(argv[2]);
+    }
+    // --video <zoom script> [frames per 2x] [output] or --video-to <x> <y> <magnification> [frames per 2x] [output]
+    if (argc > 2 && (string(argv[1]) == "--video" || (string(argv[1]) == "--video-to" && argc > 4))) {
+        bool to_point = string(argv[1]) == "--video-to";
+        int first_option = to_point ? 5 : 3;
+        if (argc > first_option) video_frames_per_2x = max(1, stoi(argv[first_option]));
+        string output = argc > first_option + 1 ? argv[first_option + 1] : "zoom.avi";
+        vector<ZoomView> path;
+        if (to_point) {
+            ZoomView home = home_zoom_view();
+            long double target_magnification = stold(argv[4]);
+            path = { home, { stold(argv[2]), stold(argv[3]), home.x_dist / target_magnification, home.y_dist / target_magnification } };
+        }
+        else path = script_zoom_path("zooms/" + string(argv[2]), zoom_factor);
+        return render_zoom_video<T_IMG>(path, output, intensity);
+    }
+    // --video-expmap <x> <y> <magnification> [frames per 2x] [output], a zoom centered on the point from one log-polar strip
+    if (argc > 4 && string(argv[1]) == "--video-expmap") {
+        if (argc > 5) video_frames_per_2x = max(1, stoi(argv[5]));
+        string output = argc > 6 ? argv[6] : "zoom.avi";
+        return render_expmap_video<T_IMG>(complex<long double>(stold(argv[2]), stold(argv[3])), stold(argv[4]), output, intensity);
+    }
+    // --video-keyframes <x> <y> <magnification> [frames per 2x] [oversampling] [output], frames cropped from every 2x zoom
+    if (argc > 4 && string(argv[1]) == "--video-keyframes") {
+        if (argc > 5) video_frames_per_2x = max(1, stoi(argv[5]));
+        if (argc > 6) keyframe_oversampling = max(1.f, stof(argv[6]));
+        string output = argc > 7 ? argv[7] : "zoom.avi";
+        return render_keyframe_video<T_IMG>(complex<long double>(stold(argv[2]), stold(argv[3])), stold(argv[4]), output, intensity);
+    }
+    if (argc > 1 && string(argv[1]) == "--coordinator") {
+        unsigned short port = argc > 2 ? (unsigned short)stoi(argv[2]) : dist_default_port;
+        unsigned int local_workers = argc > 3 ? stoi(argv[3]) : 0;
+        if (!start_coordinator(port, local_workers)) exit(1);
+    }
     cout << endl;
 
-    st.push(MandelArea<T_IMG>(first_start_x, first_end_x, first_start_y, first_end_y, aspect_ratio, hor_resolution, intensity, magnification));
+    MandelArea<T_IMG> home = home_area();
+    show_home_view(home);
+    st.push(move(home));
 
     namedWindow(w_name);
 
@@ -267,22 +484,117 @@ int main() {
 
     // Common resoltions: 1024, 2048, 4K: 4096, 8K: 7680, 16K: 15360
 
-    cout << endl << "Press z to start a guided zoom" << endl << "Press s to save a picture" << endl << "Press Esc to exit" << endl;
+    cout << endl << "Press z to start a guided zoom" << endl << "Press s to save a picture and b to cycle its format (8/16-bit PNG, 16-bit/float TIFF, float EXR)" << endl << "Press l to toggle snapping zooms to the pixel grid of the previous frame" << endl << "Press t to toggle the tile cache (zooms by powers of two, back to the home view; --tile-cache starts with it)" << endl << "Press m to toggle multi-process rendering for frames from " << shm_min_width << " px width" << endl << "Press + / - to change the intensity, c to cycle the hue and v to cycle the palettes from " << palette_file << " (no recalculation)" << endl << "Press f to toggle smooth coloring and h to toggle histogram coloring" << endl << "Right click on the first frame to zoom out of it" << endl << "Press p to toggle the perturbation kernel" << endl << "Press a to toggle adaptive anti-aliasing" << endl << "Press q to toggle preview rendering at window size" << endl << "Press o to cycle the palette through the frame (no recalculation)" << endl << "Press i to double the iteration limit (only unresolved pixels are iterated)" << endl << "Use the arrow keys or Ctrl + drag to pan" << endl << "Press r to restore the session of the last exit" << endl << "Press Esc to exit (saves the session)" << endl;
 
     cout << endl;
 
     while (true) {
-        char pressed_key = (char)waitKey(10);
-        if ((char)27 == pressed_key) break;
+        int key_code = waitKeyEx(palette_cycle.active() ? 1 : 10);
+        char pressed_key = (char)key_code;
+        if (palette_cycle.active() && key_code != -1 && (char)111 != pressed_key) {
+            palette_cycle.stop();
+            imshow(w_name, st.top().display);
+        }
+        palette_cycle.tick();
+        if (st.size() == 1 && take_home_refresh(st.top())) st.top().show();
+        update_full_res_render();
+        if ((char)27 == pressed_key) {
+            if (st.save_session("last")) cout << "Session saved to " << session_dir << "last.session" << endl;
+            stop_home_check();
+            break;
+        }
+        else if (key_code == 2424832) pan_view(-pan_step, 0); // Arrow keys
+        else if (key_code == 2555904) pan_view(pan_step, 0);
+        else if (key_code == 2490368) pan_view(0, -pan_step);
+        else if (key_code == 2621440) pan_view(0, pan_step);
         else if ((char)115 == pressed_key) {
-            MandelArea<T_IMG> area = st.top();
-            cout << "Saving picture to " << area.filename << endl;
-            imwrite(area.filename, area.img);
+            save_picture();
+        }
+        else if ((char)98 == pressed_key) {
+            output_format = (output_format + 1) % n_output_formats;
+            cout << "Pictures are saved as " << output_formats[output_format].name << endl;
         }
         else if ((char)122 == pressed_key) {
             cout << endl << "Starting guided zoom..." << endl;
             startZoom("");
         }
+        else if ((char)108 == pressed_key) {
+            snap_to_parent = !snap_to_parent;
+            cout << "Snapping to the parent pixel grid " << (snap_to_parent ? "enabled" : "disabled") << endl;
+        }
+        else if ((char)43 == pressed_key || (char)45 == pressed_key || (char)99 == pressed_key || (char)102 == pressed_key || (char)118 == pressed_key || (char)104 == pressed_key) {
+            if ((char)43 == pressed_key) intensity *= 1.25;
+            if ((char)45 == pressed_key) intensity /= 1.25;
+            if ((char)99 == pressed_key) palette_hue_shift = (palette_hue_shift + hue_shift_step) % 180;
+            if ((char)104 == pressed_key) {
+                histogram_coloring = !histogram_coloring;
+                cout << "Histogram coloring " << (histogram_coloring ? "enabled" : "disabled") << endl;
+            }
+            st.top().equalize = histogram_coloring;
+            if ((char)118 == pressed_key) {
+                active_palette = (active_palette + 1) % get_palettes().size();
+                cout << "Palette " << get_palettes()[active_palette].name << endl;
+            }
+            if ((char)102 == pressed_key) {
+                smooth_coloring = !smooth_coloring;
+                cout << "Smooth coloring " << (smooth_coloring ? "enabled" : "disabled") << " (applies from the next frame on)" << endl;
+            }
+            chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+            st.top().recolor(intensity, palette_hue_shift, active_palette);
+            chrono::steady_clock::time_point end = chrono::steady_clock::now();
+            cout << "Recolored in " << chrono::duration_cast<chrono::milliseconds>(end - begin).count() << "[ms] (intensity=" << intensity << " hue_shift=" << palette_hue_shift << ")" << endl;
+        }
+        else if ((char)105 == pressed_key) {
+            MandelArea<T_IMG>& area = st.top();
+            chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+            area.raise_max_iter(area.max_iter * 2);
+            area.show();
+            chrono::steady_clock::time_point end = chrono::steady_clock::now();
+            cout << "Time elapsed = " << chrono::duration_cast<chrono::milliseconds>(end - begin).count() << "[ms]" << endl;
+        }
+        else if ((char)112 == pressed_key) {
+            render_kernel = render_kernel == kernel_perturbation ? kernel_escape_time : kernel_perturbation;
+            cout << "Perturbation kernel " << (render_kernel == kernel_perturbation ? "enabled" : "disabled") << " (applies from the next frame on)" << endl;
+        }
+        else if ((char)114 == pressed_key) {
+            chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+            if (st.load_session("last")) {
+                root_is_home = false; // The session's root may be zoomed out
+                MandelArea<T_IMG>& area = st.top();
+                magnification = area.magnification;
+                imshow(w_name, area.display);
+                chrono::steady_clock::time_point end = chrono::steady_clock::now();
+                cout << "Restored " << st.size() << " levels in " << chrono::duration_cast<chrono::milliseconds>(end - begin).count() << "[ms]" << endl;
+                cout << "Magnification = " << magnification << endl;
+            }
+            else cerr << "Could not restore " << session_dir << "last.session" << endl;
+        }
+        else if ((char)113 == pressed_key) {
+            preview_rendering = !preview_rendering;
+            cout << "Preview rendering " << (preview_rendering ? "enabled (frames at window size, full resolution in the background from a zoom on)" : "disabled (frames at " + to_string(hor_resolution) + " px)") << " (applies from the next frame on)" << endl;
+        }
+        else if ((char)97 == pressed_key) {
+            adaptive_aa = !adaptive_aa;
+            cout << "Adaptive anti-aliasing " << (adaptive_aa ? "enabled (frames at window size, extra samples on edges)" : "disabled") << " (applies from the next frame on)" << endl;
+        }
+        else if ((char)116 == pressed_key) {
+            use_tile_cache = !use_tile_cache;
+            cout << "Tile cache " << (use_tile_cache ? "enabled" : "disabled") << ", back to the home view" << endl;
+            // Only views on the lattice use the tiles, so the history starts over from the matching home view
+            root_is_home = false;
+            zoomOut();
+        }
+        else if ((char)111 == pressed_key) {
+            if (palette_cycle.active()) {
+                palette_cycle.stop();
+                imshow(w_name, st.top().display);
+            }
+            else palette_cycle.start(st.top());
+        }
+        else if ((char)109 == pressed_key) {
+            use_shm_workers = !use_shm_workers;
+            cout << "Multi-process rendering " << (use_shm_workers ? "enabled" : "disabled") << endl;
+        }
     }
 
     return 0;
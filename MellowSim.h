@@ -1,16 +1,18 @@
 #pragma once
 #include <iostream>
+#define WIN32_LEAN_AND_MEAN // Keeps the old winsock.h out, Distributed.h needs winsock2.h
 #include <Windows.h>
 #include <limits.h>
 #include <opencv2/opencv.hpp>
 #include <opencv2/imgproc/types_c.h>
+#include "RenderPool.h"
+#include "OrbitCache.h"
+#include "Palette.h"
 
 using namespace std;
 using namespace cv;
 
 const string w_name = "MellowSim";
-mutex img_data_mutex;
-#include <mutex>
 
 const unsigned short dist_limit = 4; //Arbitrary but has to be at least 2
 
@@ -20,6 +22,9 @@ const unsigned short n_channels = 3;
 
 const unsigned int start_max_iter = 100;
 
+const unsigned int kernel_escape_time = 0;
+const unsigned int kernel_perturbation = 1; // Iterates the difference to a reference orbit
+
 int sizes[] = { 255, 255, 255 };
 typedef Point3_<uint8_t> Pixel;
 
@@ -31,6 +36,102 @@ const float first_end_x = 1.2;
 const float first_start_y = 1.2;
 const float first_end_y = -1.2;
 
+// Frames at least this wide are split across worker processes sharing one image buffer
+const int shm_min_width = 7680;
+bool use_shm_workers = true;
+extern bool use_distributed;
+extern bool use_tile_cache;
+bool smooth_coloring = false; // Keep the continuous escape count for banding free colors
+unsigned short palette_hue_shift = 0; // Hue shift of new frames
+unsigned int active_palette = 0; // Index into get_palettes() of new frames
+bool histogram_coloring = false; // Spread the colors by the distribution of the counts instead of count / max_iter
+bool adaptive_aa = false; // Render new frames at window size and supersample only their edges
+bool preview_rendering = false; // Render new frames at window size, the full resolution frame follows in the background
+
+// Formats of saved pictures
+struct OutputFormat {
+    const char* name;
+    const char* extension;
+    int depth; // Of every channel
+};
+const OutputFormat output_formats[] = {
+    { "8-bit PNG", ".png", CV_8U },
+    { "16-bit PNG", ".png", CV_16U },
+    { "16-bit TIFF", ".tiff", CV_16U },
+    { "32-bit float TIFF", ".tiff", CV_32F },
+    { "32-bit float EXR", ".exr", CV_32F },
+};
+const int n_output_formats = sizeof(output_formats) / sizeof(output_formats[0]);
+int output_format = 0;
+
+const int aa_samples = 8; // Extra samples of an edge pixel
+const float aa_threshold = 0.1f; // Color difference to a neighbour, relative to the color depth, which makes an edge
+unsigned int render_kernel = kernel_escape_time; // Kernel of new frames
+
+// Defined in MellowSim.cpp
+void show_progress_bar(float progress);
+inline std::string time_stamp(const std::string& fmt = "%Y_%m_%d_%H_%M_%S");
+
+template <typename T>
+class MandelArea;
+
+// Defined in SharedRender.h - returns false if the worker pool is unavailable
+template <typename T>
+bool render_shared(MandelArea<T>& area);
+
+// Defined in Distributed.h - returns false if no remote worker is connected
+template <typename T>
+bool render_distributed(MandelArea<T>& area);
+
+// Defined in TileCache.h
+template <typename T>
+void assemble_from_tiles(MandelArea<T>& area);
+template <typename T>
+void store_tiles(MandelArea<T>& area);
+
+// Pixel formats of the frame, chosen at compile time by the channel type of MandelArea.
+// Formats with an image get the fused kernel, which writes the palette color of every pixel as soon as its count is
+// known. The iteration-only format (render workers) keeps the counts and never allocates an image.
+template <typename T>
+struct PixelFormat {
+    static_assert(sizeof(T) == 0, "MandelArea renders unsigned char, unsigned short or float images, or unsigned int counts without an image");
+};
+
+template <>
+struct PixelFormat<unsigned char> {
+    static const bool has_image = true;
+    static const int mat_type = CV_8UC3;
+    static constexpr float max_value = 255.f;
+};
+
+template <>
+struct PixelFormat<unsigned short> {
+    static const bool has_image = true;
+    static const int mat_type = CV_16UC3;
+    static constexpr float max_value = 65535.f;
+};
+
+template <>
+struct PixelFormat<float> {
+    static const bool has_image = true;
+    static const int mat_type = CV_32FC3;
+    static constexpr float max_value = 1.f;
+};
+
+template <>
+struct PixelFormat<unsigned int> {
+    static const bool has_image = false;
+    static const int mat_type = 0;
+    static constexpr float max_value = 0.f; // Never colored, output_image colors in float
+};
+
+// State of a pixel which reached max_iter, so it can be continued once the limit is raised
+struct CappedPixel {
+    int px;
+    unsigned int counter;
+    complex<long double> z;
+};
+
 template <typename T>
 class MandelArea {
 public:
@@ -51,13 +152,34 @@ public:
     unsigned int n_blocks;
     unsigned int left_over_pixels;
     float intensity;
-    Mat img;
-    const T color_depth = (T)-1;
+    Mat img; // Full resolution BGR frame, colored from iterations
+    Mat display; // img scaled to the window
+    const T color_depth = (T)PixelFormat<T>::max_value; // Full channel value
     unsigned long long magnification;
     unsigned long long color_magnification;
     unsigned int max_iter;
+    unsigned short hue_shift = palette_hue_shift; // 120 for blue shift
+    unsigned int palette = active_palette;
+    bool equalize = histogram_coloring;
+    bool supersample = adaptive_aa;
+    vector<int> aa_pixels; // Supersampled edge pixels
+    vector<unsigned int> aa_counts; // aa_samples counts per edge pixel
+    vector<float> aa_fractions; // Their smooth parts, only with track_smooth
+    vector<unsigned int> iterations; // 0 = in the set (or not calculated), primary result of a render
+    vector<float> smooth; // Continuous part of the escape counts, only with track_smooth
+    bool track_smooth = smooth_coloring;
+    unsigned int kernel = render_kernel;
+    OrbitData reference; // Only with kernel_perturbation
+    complex<long double> reference_offset; // Center pixel of the view minus the center of the reference orbit
+    int level = -1; // Level of the tile pyramid this view is aligned to, -1 if it is not
+    long long grid_x = 0; // Lattice point of the top left pixel
+    long long grid_y = 0;
+    long long mirror_sum = -1; // Row y is the conjugate of row mirror_sum - y, -1 if the view does not cross the real axis
+    vector<unsigned char> known; // Pixels whose iteration count was taken over before rendering
+    vector<CappedPixel> capped; // Iterated pixels which reached max_iter, sorted by pixel index
+    vector<vector<CappedPixel>> block_capped; // Collected per block while rendering
 
-    MandelArea(long double x_start, long double x_end, long double y_start, long double y_end, float ratio, int width, float intensity, unsigned long long magnification) {
+    MandelArea(long double x_start, long double x_end, long double y_start, long double y_end, float ratio, int width, float intensity, unsigned long long magnification, bool render = true) {
         //bool is_signed = false;
         //if (color_depth < 0) {
         //    is_signed = true;
@@ -73,6 +195,13 @@ public:
         this->height = width / ratio;
         this->x_per_px = x_dist / width;
         this->y_per_px = y_dist / height;
+        // Views crossing the real axis are shifted by less than half a pixel, so their rows pair up exactly around it
+        if (crosses_real_axis()) {
+            long double shift = llroundl(2 * this->y_start / y_per_px) * y_per_px / 2 - this->y_start;
+            this->y_start += shift;
+            this->y_end += shift;
+        }
+        update_mirror_sum();
         this->px_count = width * height;
         this->intensity = intensity;
         this->magnification = magnification;
@@ -86,24 +215,272 @@ public:
         }
         this->n_blocks = px_count / block_size;
         this->left_over_pixels = px_count % block_size;
-        size_t mat_type = get_mat_type();
-        if (mat_type == 0) return;
-        this->img = Mat(height, width, mat_type);
+        if (render) this->render();
+    }
+
+    void render() {
+        if (!this->compute()) return;
+        show();
+    }
+
+    void show() {
+        if constexpr (!PixelFormat<T>::has_image) return;
+        update_display();
+        imshow(w_name, display);
+    }
+
+    void update_display() {
+        resize(img, display, Size(w_width, w_width / ratio), INTER_LINEAR_EXACT);
+    }
+
+    // Renders the full resolution frame without showing it
+    bool compute() {
+        if (iterations.size() != (size_t)px_count) iterations.assign(px_count, 0);
+        if (known.size() != (size_t)px_count) known.assign(px_count, 0);
+        if (track_smooth && smooth.size() != (size_t)px_count) smooth.assign(px_count, 0.f);
+        clear_supersamples();
+        bool tiled = use_tile_cache && level >= 0 && !track_smooth; // Tiles carry no smooth part
+        if (tiled) assemble_from_tiles(*this);
+        mark_mirrored_rows();
         this->write_img(intensity, false);
-        resize(img, img, Size(w_width, w_width / ratio), INTER_LINEAR_EXACT);
-        imshow(w_name, img);
+        if (tiled) store_tiles(*this);
+        if (supersample) supersample_edges();
+        vector<unsigned char>().swap(known);
+        return true;
+    }
+
+    bool crosses_real_axis() {
+        return y_start > 0 && y_start - (height - 1) * y_per_px < 0;
+    }
+
+    void update_mirror_sum() {
+        mirror_sum = -1;
+        if (!crosses_real_axis()) return;
+        long double axis = 2 * y_start / y_per_px;
+        if (fabsl(axis - llroundl(axis)) < 1e-6L) mirror_sum = llroundl(axis);
+    }
+
+    // Moves the view by whole pixels (positive dx to the right, positive dy down).
+    // Counts and colors which stay inside the view are shifted along, only the exposed strips are iterated and colored.
+    void pan(int dx, int dy) {
+        if (dx == 0 && dy == 0) return;
+        bool have_counts = iterations.size() == (size_t)px_count;
+        if (!have_counts) {
+            move_view(dx, dy);
+            compute();
+            return;
+        }
+        bool keep_smooth = smooth.size() == (size_t)px_count;
+        vector<unsigned int> moved(px_count, 0);
+        vector<float> moved_smooth(keep_smooth ? px_count : 0, 0.f);
+        known.assign(px_count, 0);
+        int first_x = max(0, -dx);
+        int last_x = min(width, width - dx);
+        int first_y = max(0, -dy);
+        int last_y = min(height, height - dy);
+        for (int y = first_y; y < last_y && first_x < last_x; y++) {
+            size_t target = (size_t)y * width + first_x;
+            size_t source = (size_t)(y + dy) * width + first_x + dx;
+            memcpy(&moved[target], &iterations[source], (last_x - first_x) * sizeof(unsigned int));
+            if (keep_smooth) memcpy(&moved_smooth[target], &smooth[source], (last_x - first_x) * sizeof(float));
+            memset(&known[target], 1, last_x - first_x);
+        }
+        iterations.swap(moved);
+        smooth.swap(moved_smooth);
+        vector<CappedPixel> moved_capped;
+        for (CappedPixel pixel : capped) {
+            int x = pixel.px % width - dx;
+            int y = pixel.px / width - dy;
+            if (x < 0 || x >= width || y < 0 || y >= height) continue;
+            pixel.px = y * width + x;
+            moved_capped.push_back(pixel);
+        }
+        capped.swap(moved_capped);
+        if (img.rows == height && img.cols == width) {
+            Mat moved_img(img.size(), img.type(), Scalar::all(0));
+            if (first_x < last_x && first_y < last_y) {
+                img(Rect(first_x + dx, first_y + dy, last_x - first_x, last_y - first_y)).copyTo(moved_img(Rect(first_x, first_y, last_x - first_x, last_y - first_y)));
+            }
+            img = moved_img;
+        }
+        clear_supersamples();
+        move_view(dx, dy);
+
+        // Only the exposed pixels are iterated, the tiles and the mirrored rows are left to the next full render
+        prepare_kernel();
+        const int rows_per_task = 16;
+        int n_bands = (height + rows_per_task - 1) / rows_per_task;
+        vector<vector<CappedPixel>> band_capped(n_bands);
+        get_render_pool().parallel_for(n_bands, [&](int band) {
+            int last_row = min((band + 1) * rows_per_task, height);
+            for (int y = band * rows_per_task; y < last_row; y++) {
+                for (int x = 0; x < width; x++) {
+                    int px = y * width + x;
+                    if (known[px]) continue;
+                    complex<long double> z = 0;
+                    unsigned int counter = 0;
+                    iterations[px] = pixel_iter_nr(x, y, z, counter, keep_smooth ? &smooth[px] : nullptr);
+                    if (iterations[px] == 0) band_capped[band].push_back({ px, counter, z });
+                }
+            }
+        });
+        for (const vector<CappedPixel>& band : band_capped) capped.insert(capped.end(), band.begin(), band.end());
+        sort(capped.begin(), capped.end(), [](const CappedPixel& a, const CappedPixel& b) { return a.px < b.px; });
+        vector<unsigned char>().swap(known);
+        // Histogram colors depend on the counts of the whole frame, the kept part is colored again with them
+        if (img.rows == height && img.cols == width && !equalize) colorize_strips(first_x, last_x, first_y, last_y);
+        else colorize();
+    }
+
+    void move_view(int dx, int dy) {
+        this->x_start += dx * x_per_px;
+        this->x_end += dx * x_per_px;
+        this->y_start -= dy * y_per_px;
+        this->y_end -= dy * y_per_px;
+        this->grid_x += dx;
+        this->grid_y += dy;
+        this->filename = get_filename();
+        update_mirror_sum();
+    }
+
+    // Raises max_iter and continues only the pixels which reached the old limit, escaped pixels keep their counts.
+    // Pixels without a stored state (taken over from tiles or rendered remotely) start over.
+    void raise_max_iter(unsigned int new_max_iter) {
+        if (new_max_iter <= max_iter || iterations.size() != (size_t)px_count) return;
+        vector<CappedPixel> pending;
+        size_t next = 0;
+        size_t resumed = 0;
+        for (int px = 0; px < px_count; px++) {
+            while (next < capped.size() && capped[next].px < px) next++;
+            if (iterations[px] != 0 || is_mirrored_row(px / width)) continue;
+            if (next < capped.size() && capped[next].px == px) {
+                pending.push_back(capped[next]);
+                resumed++;
+            }
+            else pending.push_back({ px, 0, 0 });
+        }
+        prepare_kernel();
+        cout << endl << "Raising max_iter from " << max_iter << " to " << new_max_iter << " for " << pending.size() << " pixels (" << resumed << " resumed)." << endl;
+        this->max_iter = new_max_iter;
+        bool keep_smooth = smooth.size() == (size_t)px_count;
+        const int pixels_per_task = 4096;
+        int n_tasks = (int)((pending.size() + pixels_per_task - 1) / pixels_per_task);
+        get_render_pool().parallel_for(n_tasks, [&](int task) {
+            size_t last = min(pending.size(), (size_t)(task + 1) * pixels_per_task);
+            for (size_t i = (size_t)task * pixels_per_task; i < last; i++) {
+                CappedPixel& pixel = pending[i];
+                iterations[pixel.px] = pixel_iter_nr(pixel.px % width, pixel.px / width, pixel.z, pixel.counter, keep_smooth ? &smooth[pixel.px] : nullptr);
+            }
+        }, [n_tasks](int finished) { show_progress_bar((float)finished / (float)n_tasks); });
+        capped.clear();
+        for (const CappedPixel& pixel : pending) {
+            if (iterations[pixel.px] == 0) capped.push_back(pixel);
+        }
+        copy_mirrored_rows();
+        if (use_tile_cache && level >= 0 && !track_smooth) store_tiles(*this);
+        clear_supersamples();
+        colorize();
+        if (supersample) supersample_edges();
+    }
+
+    // Only reapplies the colors to the stored iteration counts, nothing is iterated again
+    void recolor(float new_intensity, unsigned short new_hue_shift, unsigned int new_palette) {
+        this->intensity = new_intensity;
+        this->hue_shift = new_hue_shift;
+        this->palette = new_palette;
+        colorize();
+        show();
+    }
+
+    // Takes over the iteration counts of every k-th pixel in both directions from the parent frame.
+    // This frame has to start on a pixel of the parent (offset_x, offset_y) with exactly 1/k of its pixel spacing.
+    void seed_from_parent(const MandelArea<T>& parent, int offset_x, int offset_y, int k) {
+        iterations.assign(px_count, 0);
+        known.assign(px_count, 0);
+        if (parent.iterations.size() != (size_t)parent.px_count || track_smooth) return;
+        int reused = 0;
+        for (int y = 0; y < height; y += k) {
+            int parent_y = offset_y + y / k;
+            if (parent_y >= parent.height) break;
+            for (int x = 0; x < width; x += k) {
+                int parent_x = offset_x + x / k;
+                if (parent_x >= parent.width) break;
+                unsigned int count = parent.iterations[parent_y * parent.width + parent_x];
+                // Pixels which reached the parent's max_iter may still escape with the higher limit
+                if (count == 0 || count >= max_iter) continue;
+                iterations[y * width + x] = count;
+                known[y * width + x] = 1;
+                reused++;
+            }
+        }
+        cout << endl << "Reusing " << reused << " pixels (" << setprecision(3) << 100. * reused / px_count << " %) of the parent frame." << endl;
+    }
+
+    // The set is symmetric to the real axis, so rows below it which have a partner above it are not iterated
+    void mark_mirrored_rows() {
+        if (mirror_sum < 0) return;
+        int first_row = (int)(mirror_sum / 2) + 1;
+        int last_row = (int)min(mirror_sum, (long long)height - 1);
+        for (int y = first_row; y <= last_row; y++) {
+            memset(&known[y * width], 1, width);
+        }
+        if (last_row >= first_row) cout << endl << "Mirroring " << last_row - first_row + 1 << " of " << height << " rows on the real axis." << endl;
+    }
+
+    bool is_mirrored_row(int y) const {
+        return mirror_sum >= 0 && 2 * y > mirror_sum && y <= mirror_sum;
+    }
+
+    void copy_mirrored_rows() {
+        if (mirror_sum < 0) return;
+        bool keep_smooth = smooth.size() == (size_t)px_count;
+        bool keep_colors = img.rows == height && img.cols == width; // Colored by the fused kernel
+        int first_row = (int)(mirror_sum / 2) + 1;
+        int last_row = (int)min(mirror_sum, (long long)height - 1);
+        for (int y = first_row; y <= last_row; y++) {
+            int source = (int)(mirror_sum - y);
+            memcpy(&iterations[y * width], &iterations[source * width], width * sizeof(unsigned int));
+            if (keep_smooth) memcpy(&smooth[y * width], &smooth[source * width], width * sizeof(float));
+            if (keep_colors) img.row(source).copyTo(img.row(y));
+        }
+    }
+
+    // Takes over the iteration counts of a zoomed-in child frame which lies inside this one.
+    // Pixel x of this frame is pixel k * x - shift_x of the child, which has exactly 1/k of this frame's pixel spacing.
+    void seed_from_child(const MandelArea<T>& child, int shift_x, int shift_y, int k) {
+        iterations.assign(px_count, 0);
+        known.assign(px_count, 0);
+        if (child.iterations.size() != (size_t)child.px_count || track_smooth) return;
+        int reused = 0;
+        for (int y = 0; y < height; y++) {
+            int child_y = k * y - shift_y;
+            if (child_y < 0) continue;
+            if (child_y >= child.height) break;
+            for (int x = 0; x < width; x++) {
+                int child_x = k * x - shift_x;
+                if (child_x < 0) continue;
+                if (child_x >= child.width) break;
+                unsigned int count = child.iterations[child_y * child.width + child_x];
+                // Pixels in the child's set are only known to be in this one if the limit did not grow
+                if (count == 0 && max_iter > child.max_iter) continue;
+                if (count >= max_iter) count = 0;
+                iterations[y * width + x] = count;
+                known[y * width + x] = 1;
+                reused++;
+            }
+        }
+        cout << endl << "Reusing " << reused << " pixels (" << setprecision(3) << 100. * reused / px_count << " %) of the zoomed-in frame." << endl;
     }
 
     size_t get_mat_type() {
-        const type_info& id = typeid(T);
-        if (id == typeid(char)) return CV_8SC3;
-        if (id == typeid(short)) return CV_16SC3;
-        //if (id == typeid(int)) return CV_32SC3;
-        if (id == typeid(float)) return CV_32FC3;
-        if (id == typeid(double)) return CV_64FC3;
-        if (id == typeid(unsigned char)) return CV_8UC3;
-        if (id == typeid(unsigned short)) return CV_16UC3;
-        return 0;
+        return PixelFormat<T>::mat_type;
+    }
+
+    // Writes the frame to filename with the extension and channel depth of format
+    bool save(const OutputFormat& format) {
+        string path = filename.substr(0, filename.rfind('.')) + format.extension;
+        cout << "Saving picture to " << path << " (" << format.name << ")" << endl;
+        return imwrite(path, output_image(format.depth));
     }
 
     string get_filename() {
@@ -115,68 +492,127 @@ public:
         return filename;
     }
 
-    complex<long double> scaled_coord(int x, int y, float x_start, float y_start) {
+    complex<long double> scaled_coord(int x, int y, long double x_start, long double y_start) {
         //Real axis ranges from -2.5 to 1
         //Imaginary axis ranges from -1 to 1 but is mirrored on the real axis
-        return complex<double>(x_start + x * x_per_px, y_start - y * y_per_px);
+        return complex<long double>(x_start + x * x_per_px, y_start - y * y_per_px);
     }
 
-    unsigned int get_iter_nr(complex<long double> c) {
+    // fraction receives the smooth (continuous) part of the escape count if it is not null
+    unsigned int get_iter_nr(complex<long double> c, float* fraction = nullptr) {
         unsigned int counter = 0;
         complex<long double> z = 0;
+        return continue_iter_nr(c, z, counter, fraction);
+    }
+
+    // Fetches the reference orbit of the perturbation kernel, has to be called before pixels are iterated
+    void prepare_kernel() {
+        if (kernel != kernel_perturbation) return;
+        reference = get_orbit_cache().find_or_compute(x_start, x_start + width * x_per_px, y_start, y_start - height * y_per_px, min(x_per_px, y_per_px), max_iter);
+        // The only difference of absolute coordinates, every pixel is an offset in pixels from the center pixel
+        reference_offset = complex<long double>(x_start + (width / 2) * x_per_px, y_start - (height / 2) * y_per_px) - reference->center;
+    }
+
+    // Iterates the point at pixel (x, y) of the view, which may lie between pixels or outside of the view, from the
+    // state (z, counter) on. The perturbation kernel starts from the pixel offset to the center pixel, so its dc keeps
+    // the precision of the pixel spacing instead of the one of the coordinates.
+    unsigned int pixel_iter_nr(long double x, long double y, complex<long double>& z, unsigned int& counter, float* fraction = nullptr) {
+        if (counter == 0 && kernel == kernel_perturbation && reference != nullptr) {
+            complex<long double> dc((x - width / 2) * x_per_px, -(y - height / 2) * y_per_px);
+            return perturbed_iter_nr(dc + reference_offset, z, counter, fraction);
+        }
+        return continue_iter_nr(complex<long double>(x_start + x * x_per_px, y_start - y * y_per_px), z, counter, fraction);
+    }
+
+    // Iterates from the state (z, counter) on, which is left at the last iteration reached. Always the escape time
+    // kernel, pixels go through pixel_iter_nr.
+    unsigned int continue_iter_nr(complex<long double> c, complex<long double>& z, unsigned int& counter, float* fraction = nullptr) {
         double dist = abs(z);
         while (dist < dist_limit && counter < max_iter) {
             z = z * z + c;
             dist = abs(z);
             counter++;
         }
+        return escape_result(counter, dist, fraction);
+    }
+
+    // Perturbation against the reference orbit Z: z = Z[m] + dz with dz' = 2 * Z[m] * dz + dz^2 + dc.
+    // dz is rebased onto the start of the orbit when z gets smaller than dz or the orbit ends.
+    unsigned int perturbed_iter_nr(complex<long double> dc, complex<long double>& z, unsigned int& counter, float* fraction) {
+        const vector<complex<long double>>& orbit = reference->z;
+        complex<long double> dz = 0;
+        size_t m = 0;
+        double dist = 0;
+        z = 0;
+        while (dist < dist_limit && counter < max_iter) {
+            dz = 2.L * orbit[m] * dz + dz * dz + dc;
+            m++;
+            z = orbit[m] + dz;
+            dist = abs(z);
+            counter++;
+            if (m + 1 >= orbit.size() || norm(z) < norm(dz)) {
+                dz = z;
+                m = 0;
+            }
+        }
+        return escape_result(counter, dist, fraction);
+    }
+
+    unsigned int escape_result(unsigned int counter, double dist, float* fraction) {
         if (counter == max_iter) {
+            if (fraction != nullptr) *fraction = 0.f;
             return 0;
         } //Complex number is in the set and therefore is colored black
         else {
+            if (fraction != nullptr) *fraction = (float)(1. - log2(log(dist)));
             return counter;
         }
     }
 
-    void calculate_block(int current_block, float intensity) {
-        // Gradual colors --> could be improved by weighting different colors to certain spans
-        float r_factor = 0.0;
-        float g_factor = 0.0;
-        float b_factor = 0.0;
+    // iter_factor is the position of the count in the palette, from 0 to 1.
+    // Writes the float HSV color: hue in degrees, saturation and value from 0 to 1.
+    void color_pixel(float* data, unsigned int iterations, float iter_factor) {
+        float hue = 0.f;
+        float value = 0.f;
+
+        if (iterations != 0 && iterations < max_iter) {
+            unsigned short hue_depth = 180; // hue_shift counts in steps of 2 degrees like 8-bit HSV
+            hue = 2.f * ((int)(iter_factor * (hue_depth - 1) + hue_shift) % hue_depth);
+            float brightness = equalize ? iter_factor : 100 * intensity * iter_factor;
+            value = min(brightness, 1.f);
+        }
+
+        data[0] = hue;
+        data[1] = 1.f;
+        data[2] = value;
+    }
+
+    // With write_colors, the palette color of every pixel of the block goes into img right after its count
+    template <bool write_colors>
+    void calculate_block(int current_block, const T* lut) {
         int pixel_offset = current_block * block_size;
         unsigned int needed_pxs = current_block == n_blocks ? left_over_pixels : block_size;
-        size_t data_size = needed_pxs * n_channels * sizeof(T);
-        T* data_begin = (T*)malloc(data_size);
-        T* data = data_begin;
-        T* end = data + needed_pxs * n_channels;
+        int end = pixel_offset + needed_pxs;
+        bool keep_smooth = smooth.size() == (size_t)px_count;
 
         unsigned int current_x = pixel_offset % width;
         unsigned int current_y = pixel_offset / width;
-        T* data_destination = img.ptr<T>() + pixel_offset * n_channels;
-        unsigned char hue_depth = 180;
-        unsigned char hue_shift = 0; // 120 for blue shift
- 
-        for (; data != end; data++) {
-            complex<long double> c = scaled_coord(current_x, current_y, x_start, y_start);
-            unsigned int iterations = get_iter_nr(c);
-
-            T hue = 0;
-            T value = 0;
-
-            if (iterations < max_iter) {
-                float iter_factor = (float)iterations / (float)max_iter;
-                unsigned short hue_depth = 180;
-                unsigned short hue_shift = 0;
-                hue = (iter_factor * (hue_depth - 1)) + hue_shift;
-                hue = min(hue, (int)hue_depth);
-                value = min((int)(200 * iter_factor * color_depth), color_depth);
-            }
-
-            *data = hue;
-            data++;
-            *data = color_depth;
-            data++;
-            *data = value;
+        T* colors = write_colors ? img.ptr<T>(0) : nullptr;
+
+        for (int px = pixel_offset; px != end; px++) {
+            if (!known[px]) {
+                complex<long double> z = 0;
+                unsigned int counter = 0;
+                iterations[px] = pixel_iter_nr(current_x, current_y, z, counter, keep_smooth ? &smooth[px] : nullptr);
+                if (iterations[px] == 0) block_capped[current_block].push_back({ px, counter, z });
+            }
+            if constexpr (write_colors) {
+                const T* color = lut + n_channels * (size_t)min(iterations[px], max_iter);
+                T* data = colors + n_channels * (size_t)px;
+                data[0] = color[0];
+                data[1] = color[1];
+                data[2] = color[2];
+            }
 
             if (current_x % (width - 1) == 0 && current_x != 0) {
                 current_x = 0;
@@ -184,44 +620,315 @@ public:
             }
             else current_x++;
         }
-        img_data_mutex.lock();
-        if (data_begin != nullptr) {
-            memcpy(data_destination, data_begin, data_size);
-            free(data_begin);
+    }
+
+    // Iteration counts of whole rows, for workers which leave the coloring to the front end
+    void calculate_iterations(int first_row, int n_rows, unsigned int* destination) {
+        int last_row = min(first_row + n_rows, height);
+        unsigned int* data = destination;
+        for (int y = first_row; y < last_row; y++) {
+            for (int x = 0; x < width; x++) {
+                complex<long double> z = 0;
+                unsigned int counter = 0;
+                *data++ = pixel_iter_nr(x, y, z, counter);
+            }
+        }
+    }
+
+    // Share of the escaped pixels with at most each count. Every part of the frame is counted into its own
+    // histogram, the histograms are then summed up per range of counts, so no locks are needed.
+    vector<float> count_cdf() {
+        RenderPool& pool = get_render_pool();
+        int n_parts = (int)pool.size();
+        size_t n_counts = (size_t)max_iter + 1;
+        vector<vector<unsigned int>> histograms(n_parts, vector<unsigned int>(n_counts, 0));
+        pool.parallel_for(n_parts, [&](int part) {
+            vector<unsigned int>& histogram = histograms[part];
+            size_t last = (size_t)px_count * (part + 1) / n_parts;
+            for (size_t px = (size_t)px_count * part / n_parts; px < last; px++) {
+                histogram[min(iterations[px], max_iter)]++;
+            }
+        });
+        vector<unsigned int> merged(n_counts, 0);
+        pool.parallel_for(n_parts, [&](int part) {
+            size_t last = n_counts * (part + 1) / n_parts;
+            for (size_t count = n_counts * part / n_parts; count < last; count++) {
+                for (const vector<unsigned int>& histogram : histograms) merged[count] += histogram[count];
+            }
+        });
+        // Pixels in the set (0) and at the limit are not part of the distribution
+        unsigned long long total = 0;
+        for (size_t count = 1; count < max_iter; count++) total += merged[count];
+        vector<float> cdf(n_counts, 0.f);
+        unsigned long long running = 0;
+        for (size_t count = 1; count < max_iter && total > 0; count++) {
+            running += merged[count];
+            cdf[count] = (float)running / total;
+        }
+        return cdf;
+    }
+
+    // BGR color of every iteration count from 0 to max_iter with channels from 0 to 1, built once per frame
+    vector<float> palette_lut() {
+        vector<float> lut(n_channels * (size_t)(max_iter + 1), 0.f);
+        vector<float> factors;
+        if (equalize) factors = count_cdf();
+        else {
+            factors.resize((size_t)max_iter + 1);
+            for (unsigned int i = 0; i <= max_iter; i++) factors[i] = (float)i / max_iter;
+        }
+        const Palette& colors = get_palettes()[palette % get_palettes().size()];
+        if (colors.hue_cycle) {
+            Mat row(1, max_iter + 1, CV_32FC3, lut.data());
+            for (unsigned int i = 0; i <= max_iter; i++) color_pixel(&lut[n_channels * i], i, factors[i]);
+            cvtColor(row, row, CV_HSV2BGR);
+            return lut;
+        }
+        for (unsigned int i = 1; i < max_iter; i++) {
+            float value = equalize ? factors[i] : min(100 * intensity * factors[i], 1.f);
+            lut[n_channels * i] = min(colors.b_factor * value, 1.f);
+            lut[n_channels * i + 1] = min(colors.g_factor * value, 1.f);
+            lut[n_channels * i + 2] = min(colors.r_factor * value, 1.f);
+        }
+        return lut;
+    }
+
+    // The table in the range of the channel type P, e.g. 0 to 255 for 8-bit images
+    template <typename P>
+    static vector<P> scaled_lut(const vector<float>& lut, float depth) {
+        vector<P> scaled(lut.size());
+        float rounding = is_floating_point<P>::value ? 0.f : 0.5f;
+        for (size_t i = 0; i < lut.size(); i++) scaled[i] = (P)(lut[i] * depth + rounding);
+        return scaled;
+    }
+
+    // Color of a count in the palette table, between two entries if the smooth part is given
+    template <typename P>
+    void lut_color(const vector<P>& lut, unsigned int count, const float* fraction, float* color) {
+        if (count == 0 || count >= max_iter) {
+            color[0] = color[1] = color[2] = 0.f;
+            return;
+        }
+        float position = fraction == nullptr ? (float)count : min(max(count + *fraction, 1.f), (float)(max_iter - 1));
+        unsigned int below = (unsigned int)position;
+        float t = position - below;
+        const P* a = &lut[n_channels * (size_t)below];
+        const P* b = &lut[n_channels * (size_t)min(below + 1, max_iter - 1)];
+        for (int channel = 0; channel < n_channels; channel++) {
+            color[channel] = a[channel] + t * ((float)b[channel] - a[channel]);
+        }
+    }
+
+    void clear_supersamples() {
+        vector<int>().swap(aa_pixels);
+        vector<unsigned int>().swap(aa_counts);
+        vector<float>().swap(aa_fractions);
+    }
+
+    // Adaptive anti-aliasing: pixels whose color differs from a neighbour by more than aa_threshold get aa_samples
+    // jittered samples more, one in each cell of a 3x3 grid around the pixel's own sample. Flat regions keep one sample.
+    void supersample_edges() {
+        clear_supersamples();
+        if (img.empty() || iterations.size() != (size_t)px_count) return;
+        RenderPool& pool = get_render_pool();
+        const int rows_per_task = 16;
+        int n_bands = (height + rows_per_task - 1) / rows_per_task;
+        vector<vector<int>> band_edges(n_bands);
+        float limit = aa_threshold * color_depth;
+        pool.parallel_for(n_bands, [&](int band) {
+            int last_row = min((band + 1) * rows_per_task, height);
+            for (int y = band * rows_per_task; y < last_row; y++) {
+                for (int x = 0; x < width; x++) {
+                    const T* pixel = img.ptr<T>(y) + n_channels * x;
+                    const int neighbours[4][2] = { { x - 1, y }, { x + 1, y }, { x, y - 1 }, { x, y + 1 } };
+                    bool edge = false;
+                    for (int i = 0; i < 4 && !edge; i++) {
+                        int nx = neighbours[i][0];
+                        int ny = neighbours[i][1];
+                        if (nx < 0 || nx >= width || ny < 0 || ny >= height) continue;
+                        const T* other = img.ptr<T>(ny) + n_channels * nx;
+                        for (int channel = 0; channel < n_channels; channel++) {
+                            if (fabs((float)pixel[channel] - (float)other[channel]) > limit) edge = true;
+                        }
+                    }
+                    if (edge) band_edges[band].push_back(y * width + x);
+                }
+            }
+        });
+        for (const vector<int>& edges : band_edges) aa_pixels.insert(aa_pixels.end(), edges.begin(), edges.end());
+
+        bool keep_smooth = track_smooth;
+        aa_counts.assign(aa_pixels.size() * aa_samples, 0);
+        if (keep_smooth) aa_fractions.assign(aa_counts.size(), 0.f);
+        const int pixels_per_task = 256;
+        int n_tasks = (int)((aa_pixels.size() + pixels_per_task - 1) / pixels_per_task);
+        pool.parallel_for(n_tasks, [&](int task) {
+            size_t last = min(aa_pixels.size(), (size_t)(task + 1) * pixels_per_task);
+            for (size_t i = (size_t)task * pixels_per_task; i < last; i++) {
+                int x = aa_pixels[i] % width;
+                int y = aa_pixels[i] / width;
+                for (int sample = 0; sample < aa_samples; sample++) {
+                    int cell = sample < 4 ? sample : sample + 1; // The center cell is the pixel's own sample
+                    long double jitter_x = (cell % 3 + aa_jitter(aa_pixels[i], 2 * sample)) / 3 - 0.5L;
+                    long double jitter_y = (cell / 3 + aa_jitter(aa_pixels[i], 2 * sample + 1)) / 3 - 0.5L;
+                    size_t index = i * aa_samples + sample;
+                    complex<long double> z = 0;
+                    unsigned int counter = 0;
+                    aa_counts[index] = pixel_iter_nr(x + jitter_x, y + jitter_y, z, counter, keep_smooth ? &aa_fractions[index] : nullptr);
+                }
+            }
+        });
+        apply_supersamples(img, scaled_lut<T>(palette_lut(), color_depth));
+        cout << "Supersampled " << aa_pixels.size() << " edge pixels (" << setprecision(3) << 100. * aa_pixels.size() / px_count << " %)" << endl;
+    }
+
+    // Deterministic jitter in [0, 1), so recoloring and rendering the same view again give the same samples
+    static long double aa_jitter(int px, int index) {
+        unsigned int h = (unsigned int)px * 2654435761u ^ (unsigned int)index * 40503u;
+        h ^= h >> 15;
+        h *= 2246822519u;
+        h ^= h >> 13;
+        return (h & 0xFFFFFF) / (long double)0x1000000;
+    }
+
+    // Replaces the colors of the edge pixels by the mean of their own and all extra samples
+    template <typename P>
+    void apply_supersamples(Mat& target, const vector<P>& lut) {
+        bool use_smooth = aa_fractions.size() == aa_counts.size() && !aa_fractions.empty();
+        P* data = target.template ptr<P>(0);
+        const int pixels_per_task = 1024;
+        int n_tasks = (int)((aa_pixels.size() + pixels_per_task - 1) / pixels_per_task);
+        get_render_pool().parallel_for(n_tasks, [&](int task) {
+            size_t last = min(aa_pixels.size(), (size_t)(task + 1) * pixels_per_task);
+            for (size_t i = (size_t)task * pixels_per_task; i < last; i++) {
+                P* pixel = data + n_channels * (size_t)aa_pixels[i];
+                float sum[n_channels] = { (float)pixel[0], (float)pixel[1], (float)pixel[2] };
+                for (int sample = 0; sample < aa_samples; sample++) {
+                    size_t index = i * aa_samples + sample;
+                    float color[n_channels];
+                    lut_color(lut, aa_counts[index], use_smooth ? &aa_fractions[index] : nullptr, color);
+                    for (int channel = 0; channel < n_channels; channel++) sum[channel] += color[channel];
+                }
+                for (int channel = 0; channel < n_channels; channel++) pixel[channel] = (P)(sum[channel] / (aa_samples + 1));
+            }
+        });
+    }
+
+    // Looks every count up in the palette table and writes the BGR image with channel type P into target
+    template <typename P>
+    void colorize_into(Mat& target, const vector<P>& lut) {
+        target.create(height, width, CV_MAKETYPE(DataType<P>::depth, n_channels));
+        bool use_smooth = track_smooth && smooth.size() == (size_t)px_count;
+        const int rows_per_task = 16;
+        get_render_pool().parallel_for((height + rows_per_task - 1) / rows_per_task, [this, use_smooth, rows_per_task, &lut, &target](int band) {
+            int last_row = min((band + 1) * rows_per_task, height);
+            for (int y = band * rows_per_task; y < last_row; y++) colorize_row(target, y, 0, width, lut, use_smooth);
+        });
+        if (!aa_pixels.empty()) apply_supersamples(target, lut);
+    }
+
+    // Colors the pixels first_x to last_x - 1 of row y
+    template <typename P>
+    void colorize_row(Mat& target, int y, int first_x, int last_x, const vector<P>& lut, bool use_smooth) {
+        P* data = target.template ptr<P>(y) + n_channels * (size_t)first_x;
+        const unsigned int* counts = &iterations[(size_t)y * width];
+        if (!use_smooth) {
+            for (int x = first_x; x < last_x; x++, data += n_channels) {
+                const P* color = &lut[n_channels * (size_t)min(counts[x], max_iter)];
+                data[0] = color[0];
+                data[1] = color[1];
+                data[2] = color[2];
+            }
+            return;
+        }
+        // The continuous count lies between two table entries
+        const float* fractions = &smooth[(size_t)y * width];
+        for (int x = first_x; x < last_x; x++, data += n_channels) {
+            float color[n_channels];
+            lut_color(lut, counts[x], &fractions[x], color);
+            for (int channel = 0; channel < n_channels; channel++) data[channel] = (P)color[channel];
+        }
+    }
+
+    // Colors img outside of the rectangle first_x..last_x, first_y..last_y which was kept by a pan
+    void colorize_strips(int first_x, int last_x, int first_y, int last_y) {
+        if constexpr (PixelFormat<T>::has_image) {
+            vector<T> lut = scaled_lut<T>(palette_lut(), color_depth);
+            bool use_smooth = track_smooth && smooth.size() == (size_t)px_count;
+            for (int y = 0; y < height; y++) {
+                if (y < first_y || y >= last_y || first_x >= last_x) colorize_row(img, y, 0, width, lut, use_smooth);
+                else {
+                    colorize_row(img, y, 0, first_x, lut, use_smooth);
+                    colorize_row(img, y, last_x, width, lut, use_smooth);
+                }
+            }
+        }
+    }
+
+    // Turns the iteration buffer into the BGR image
+    void colorize() {
+        if constexpr (PixelFormat<T>::has_image) {
+            if (iterations.size() != (size_t)px_count) return;
+            colorize_into(img, scaled_lut<T>(palette_lut(), color_depth));
         }
-        img_data_mutex.unlock();
+    }
+
+    // The frame for writing with 8, 16 or 32 (float) bits per channel. Depths other than the one of img are colored
+    // in float and converted once at the end, so nothing is quantized before.
+    Mat output_image(int depth) {
+        if ((PixelFormat<T>::has_image && depth == img.depth()) || iterations.size() != (size_t)px_count) return img;
+        Mat colors;
+        colorize_into(colors, palette_lut());
+        if (depth == CV_32F) return colors;
+        Mat converted;
+        colors.convertTo(converted, CV_MAKETYPE(depth, n_channels), depth == CV_16U ? 65535. : 255.);
+        return converted;
     }
 
     void write_img(float intensity, bool save_img) {
-        auto processor_count = thread::hardware_concurrency();
-        processor_count = processor_count <= 0 ? 1 : processor_count;
-        cout << endl << "Calculating Mandelbrot on " << processor_count << " cores." << endl;
-        int remaining_blocks = n_blocks;
-        int current_block = 0;
-        while (remaining_blocks > 0) {
-            float progress = n_blocks != 0 ? 1 - ((float)remaining_blocks / (float)n_blocks) : 1.;
-            show_progress_bar(progress);
-            int current_starting_block = n_blocks - remaining_blocks;
-            vector<thread> threads(min((int)processor_count, remaining_blocks));
-            for (size_t i = 0; i < threads.size(); ++i) {
-                threads[i] = thread([this, current_block, intensity] {calculate_block(current_block, intensity); });
-                current_block = i + 1 + current_starting_block;
-            }
-            for (size_t i = 0; i < threads.size(); ++i) {
-                remaining_blocks--;
-                threads[i].join();
-            }
-        }
-        if (left_over_pixels > 0) {
-            calculate_block(current_block, intensity);
-        }
-        float progress = 1 - ((float)remaining_blocks / (float)n_blocks);
-        show_progress_bar(progress);
-        
+        bool rendered = false;
+        prepare_kernel();
+        // Remote workers iterate whole rows, so frames which are mostly known already (e.g. after panning) stay local
+        bool mostly_known = known.size() == (size_t)px_count && count(known.begin(), known.end(), 0) < px_count / 2;
+        if (use_distributed && !mostly_known) {
+            rendered = render_distributed(*this);
+        }
+        if (!rendered && !mostly_known && use_shm_workers && width >= shm_min_width) {
+            rendered = render_shared(*this);
+        }
+        bool colored = false;
+        if (!rendered) {
+            colored = calculate_blocks();
+        }
+        copy_mirrored_rows();
+
         cout << endl << setprecision(numeric_limits<long double>::max_digits10) << "start_x=" << x_start << " start_y=" << y_start << endl;
-        cvtColor(img, img, CV_HSV2BGR);
+        if (kernel == kernel_perturbation) get_orbit_cache().print_stats();
+        if (!colored) colorize();
         if (save_img) imwrite(filename, img);
-    } 
+    }
+
+    // Returns true if img was colored along with the counts. That needs the palette table before any count is known,
+    // so histogram and smooth coloring still color afterwards.
+    bool calculate_blocks() {
+        RenderPool& pool = get_render_pool();
+        cout << endl << "Calculating Mandelbrot on " << pool.size() << " cores." << endl;
+        int total_blocks = n_blocks + (left_over_pixels > 0 ? 1 : 0);
+        block_capped.assign(total_blocks, vector<CappedPixel>());
+        bool fused = PixelFormat<T>::has_image && !equalize && !track_smooth;
+        vector<T> lut;
+        if (fused) {
+            lut = scaled_lut<T>(palette_lut(), color_depth);
+            img.create(height, width, get_mat_type());
+        }
+        auto progress = [total_blocks](int finished) { show_progress_bar((float)finished / (float)total_blocks); };
+        if (fused) pool.parallel_for(total_blocks, [this, &lut](int block) { calculate_block<true>(block, lut.data()); }, progress);
+        else pool.parallel_for(total_blocks, [this](int block) { calculate_block<false>(block, nullptr); }, progress);
+        for (const vector<CappedPixel>& block : block_capped) capped.insert(capped.end(), block.begin(), block.end());
+        vector<vector<CappedPixel>>().swap(block_capped);
+        sort(capped.begin(), capped.end(), [](const CappedPixel& a, const CappedPixel& b) { return a.px < b.px; });
+        return fused;
+    }
     // Alternative:
     //    //for (Pixel& p : cv::Mat_<Pixel>(img)) {
     //    //    complex<double> c = scaled_coord(current_x, current_y, x_start, y_start);
@@ -0,0 +1,106 @@
+#pragma once
+#include <complex>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <limits>
+#include <iostream>
+
+using namespace std;
+
+// Reference orbits for the perturbation kernel.
+// Computing the orbit is the serial part of a perturbation render, so orbits are kept by (center, length) and reused
+// by every later view which still contains the center, e.g. successive zooms, guided zoom replays and video frames.
+// An orbit which is too short is extended from its last point. Orbits and pixel offsets are long doubles, so views
+// whose pixels are closer than the mantissa resolves around their coordinates are counted and reported.
+
+const size_t orbit_cache_entries = 8;
+const int orbit_guard_bits = 8; // Precision needed beyond the bits between the coordinates and the pixel spacing
+
+struct ReferenceOrbit {
+    complex<long double> center;
+    vector<complex<long double>> z; // z[0] = 0 up to the requested length or the escape
+    bool escaped = false;
+};
+
+typedef shared_ptr<const ReferenceOrbit> OrbitData;
+
+class OrbitCache {
+public:
+    // view_* are the corners of the view, pixel_spacing the smaller distance between two pixels
+    OrbitData find_or_compute(long double view_x_start, long double view_x_end, long double view_y_start, long double view_y_end, long double pixel_spacing, unsigned int length) {
+        // Bits from the largest coordinate of the view down to its pixel spacing
+        long double magnitude = max(max(fabsl(view_x_start), fabsl(view_x_end)), max(max(fabsl(view_y_start), fabsl(view_y_end)), 1.L));
+        int needed = (int)ceil(log2l(magnitude / pixel_spacing)) + orbit_guard_bits;
+        lock_guard<mutex> lock(orbits_mutex);
+        if (needed > numeric_limits<long double>::digits) {
+            too_deep++;
+            max_needed = max(max_needed, needed);
+        }
+        for (size_t i = 0; i < orbits.size(); i++) {
+            OrbitData orbit = orbits[i];
+            if (!contains(orbit->center, view_x_start, view_x_end, view_y_start, view_y_end)) continue;
+            orbits.erase(orbits.begin() + i);
+            if (!orbit->escaped && orbit->z.size() < (size_t)length + 1) {
+                orbit = extend(*orbit, length);
+                extensions++;
+            }
+            else hits++;
+            orbits.insert(orbits.begin(), orbit);
+            return orbit;
+        }
+        ReferenceOrbit start;
+        start.center = complex<long double>((view_x_start + view_x_end) / 2, (view_y_start + view_y_end) / 2);
+        start.z.push_back(0);
+        OrbitData orbit = extend(start, length);
+        misses++;
+        orbits.insert(orbits.begin(), orbit);
+        if (orbits.size() > orbit_cache_entries) orbits.pop_back();
+        return orbit;
+    }
+
+    // Once per frame, not per lookup: workers and video threads fetch orbits concurrently
+    void print_stats() {
+        lock_guard<mutex> lock(orbits_mutex);
+        cout << "Reference orbits: " << hits << " reused, " << extensions << " extended, " << misses << " computed" << endl;
+        if (too_deep > 0) {
+            cerr << too_deep << " views needed up to " << max_needed << " bits, long double only has " << numeric_limits<long double>::digits
+                << " (pixels there are not resolved)" << endl;
+        }
+    }
+
+private:
+    vector<OrbitData> orbits; // Most recently used first
+    mutex orbits_mutex;
+    unsigned long long hits = 0;
+    unsigned long long extensions = 0;
+    unsigned long long misses = 0;
+    unsigned long long too_deep = 0; // Views beyond the precision of long double
+    int max_needed = 0;
+
+    static bool contains(complex<long double> point, long double x_start, long double x_end, long double y_start, long double y_end) {
+        return point.real() >= min(x_start, x_end) && point.real() <= max(x_start, x_end)
+            && point.imag() >= min(y_start, y_end) && point.imag() <= max(y_start, y_end);
+    }
+
+    // Continues the orbit from its last point. Frames may still hold the old orbit, so it is copied, not changed.
+    static OrbitData extend(const ReferenceOrbit& orbit, unsigned int length) {
+        shared_ptr<ReferenceOrbit> longer = make_shared<ReferenceOrbit>(orbit);
+        longer->z.reserve((size_t)length + 1);
+        complex<long double> z = longer->z.back();
+        while (longer->z.size() < (size_t)length + 1) {
+            z = z * z + longer->center;
+            longer->z.push_back(z);
+            if (norm(z) > 16) { // |z| > dist_limit, like the pixels
+                longer->escaped = true;
+                break;
+            }
+        }
+        return longer;
+    }
+};
+
+OrbitCache& get_orbit_cache() {
+    static OrbitCache cache;
+    return cache;
+}
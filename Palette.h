@@ -0,0 +1,61 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+// Color palettes for the lookup table coloring.
+// Palette 0 is the hue cycle the renderer always had, the others are read from colors.txt. Every entry there is a
+// line "Name:" followed by the red, green and blue factors, one number per line. Anything in front of a '=' and
+// everything which is not a number is ignored, so "float r_factor = 0.7;" and "0.7" are both fine.
+
+const string palette_file = "colors.txt";
+
+struct Palette {
+    string name;
+    bool hue_cycle; // The HSV palette, no factors
+    float r_factor;
+    float g_factor;
+    float b_factor;
+};
+
+vector<Palette> load_palettes(const string& path) {
+    vector<Palette> palettes = { { "HSV", true, 0.f, 0.f, 0.f } };
+    ifstream file(path);
+    Palette current = { "", false, 0.f, 0.f, 0.f };
+    int n_factors = 3;
+    string line;
+    while (getline(file, line)) {
+        line.erase(0, line.find_first_not_of(" \t"));
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if (line.empty()) continue;
+        if (line.back() == ':') {
+            current = { line.substr(0, line.size() - 1), false, 0.f, 0.f, 0.f };
+            n_factors = 0;
+            continue;
+        }
+        if (n_factors >= 3) continue;
+        size_t separator = line.find('=');
+        string number = separator == string::npos ? line : line.substr(separator + 1);
+        float factor;
+        try {
+            factor = stof(number);
+        }
+        catch (const exception&) {
+            cerr << "Ignoring line \"" << line << "\" in " << path << endl;
+            continue;
+        }
+        if (n_factors == 0) current.r_factor = factor;
+        if (n_factors == 1) current.g_factor = factor;
+        if (n_factors == 2) current.b_factor = factor;
+        if (++n_factors == 3) palettes.push_back(current);
+    }
+    return palettes;
+}
+
+const vector<Palette>& get_palettes() {
+    static vector<Palette> palettes = load_palettes(palette_file);
+    return palettes;
+}
@@ -0,0 +1,151 @@
+#pragma once
+#include <intrin.h>
+#include "MellowSim.h"
+
+// Color cycling: the palette rotates through the escape counts of the shown frame, nothing is iterated again.
+// The counts are sampled at the window size once; every display tick rotates a table of 32-bit BGRA colors and
+// gathers one color per pixel, 8 pixels per instruction on CPUs with AVX2. The table has cycle_steps entries per
+// count, taken from the frame's own palette (histogram and smooth coloring included), so cycling starts from the
+// colors on screen. On the first start the gathers are timed at 3840x2160 without showing them.
+
+float cycle_speed = 60.f; // Counts the palette moves per second
+const int cycle_steps = 8; // Table entries per count, smooth counts move in fractions of a count
+const int cycle_benchmark_width = 3840;
+const int cycle_benchmark_height = 2160;
+const int cycle_benchmark_frames = 120;
+
+bool cpu_has_avx2() {
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    bool os_saves_ymm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return os_saves_ymm && (info[1] & (1 << 5)) != 0;
+}
+
+const bool use_avx2 = cpu_has_avx2();
+
+// out[i] = lut[indices[i]] for n pixels
+void gather_colors(const unsigned int* lut, const unsigned int* indices, unsigned int* out, size_t n) {
+    size_t i = 0;
+    if (use_avx2) {
+        for (; i + 8 <= n; i += 8) {
+            __m256i index = _mm256_loadu_si256((const __m256i*)(indices + i));
+            _mm256_storeu_si256((__m256i*)(out + i), _mm256_i32gather_epi32((const int*)lut, index, 4));
+        }
+    }
+    for (; i < n; i++) out[i] = lut[indices[i]];
+}
+
+class PaletteCycle {
+public:
+    template <typename T>
+    void start(MandelArea<T>& area) {
+        if (area.iterations.size() != (size_t)area.px_count || area.max_iter < 2) return;
+        max_iter = area.max_iter;
+        period = (max_iter - 1) * cycle_steps; // Counts 1 to max_iter - 1 take part
+        // Packed like the pixels of a CV_8UC4 image, 0 and max_iter stay black
+        vector<float> colors = area.palette_lut();
+        base.assign((size_t)(max_iter + 1) * cycle_steps, 0xFF000000u);
+        for (unsigned int i = cycle_steps; i < max_iter * cycle_steps; i++) {
+            float fraction = (float)(i % cycle_steps) / cycle_steps;
+            float color[n_channels];
+            area.lut_color(colors, i / cycle_steps, &fraction, color);
+            base[i] = (unsigned int)(color[0] * 255.f + 0.5f) | (unsigned int)(color[1] * 255.f + 0.5f) << 8
+                | (unsigned int)(color[2] * 255.f + 0.5f) << 16 | 0xFF000000u;
+        }
+        lut = base;
+
+        // Table index of every frame pixel, with the smooth part like colorize uses it
+        bool use_smooth = area.track_smooth && area.smooth.size() == (size_t)area.px_count;
+        Mat counts(area.height, area.width, CV_32SC1);
+        unsigned int* index = (unsigned int*)counts.data;
+        for (int px = 0; px < area.px_count; px++) {
+            unsigned int count = area.iterations[px];
+            if (count == 0 || count >= max_iter) index[px] = 0;
+            else if (!use_smooth) index[px] = count * cycle_steps;
+            else {
+                float position = min(max(count + area.smooth[px], 1.f), (float)(max_iter - 1));
+                index[px] = min((unsigned int)(position * cycle_steps + 0.5f), max_iter * cycle_steps - 1);
+            }
+        }
+        Mat sampled;
+        resize(counts, sampled, Size(w_width, (int)(w_width / area.ratio)), 0, 0, INTER_NEAREST);
+        indices.assign((unsigned int*)sampled.data, (unsigned int*)sampled.data + sampled.total());
+        frame.create(sampled.rows, sampled.cols, CV_8UC4);
+        if (!benchmarked) {
+            benchmark(counts);
+            benchmarked = true;
+        }
+
+        begin = chrono::steady_clock::now();
+        stats_begin = begin;
+        n_ticks = 0;
+        gather_us = 0;
+        running = true;
+        cout << "Palette cycling at " << frame.cols << "x" << frame.rows << (use_avx2 ? " with AVX2 gathers" : "") << ", any key stops it" << endl;
+    }
+
+    void stop() {
+        running = false;
+    }
+
+    bool active() const {
+        return running;
+    }
+
+    // Shows the frame with the palette rotated by the time since start
+    void tick() {
+        if (!running) return;
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        rotate(chrono::duration<double>(now - begin).count());
+        gather_colors(lut.data(), indices.data(), (unsigned int*)frame.data, indices.size());
+        gather_us += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - now).count();
+        imshow(w_name, frame);
+        n_ticks++;
+        double stats_seconds = chrono::duration<double>(now - stats_begin).count();
+        if (stats_seconds >= 2.) {
+            cout << "Palette cycling: " << setprecision(3) << n_ticks / stats_seconds << " fps shown (with imshow), " << gather_us / 1000. / n_ticks << " ms per frame for the colors" << endl;
+            stats_begin = now;
+            n_ticks = 0;
+            gather_us = 0;
+        }
+    }
+
+private:
+    bool running = false;
+    bool benchmarked = false; // The benchmark stalls the window, it runs only on the first start
+    unsigned int max_iter = 0;
+    unsigned int period = 0; // Table entries which rotate
+    vector<unsigned int> base; // Palette of the frame, cycle_steps entries per count
+    vector<unsigned int> lut; // Rotated palette of the current tick
+    vector<unsigned int> indices; // Table entries of the window pixels
+    Mat frame;
+    chrono::steady_clock::time_point begin;
+    chrono::steady_clock::time_point stats_begin;
+    int n_ticks = 0;
+    long long gather_us = 0;
+
+    void rotate(double seconds) {
+        unsigned int phase = (unsigned int)fmod(seconds * cycle_speed * cycle_steps, (double)period);
+        memcpy(&lut[cycle_steps], &base[cycle_steps + phase], (period - phase) * sizeof(unsigned int));
+        memcpy(&lut[cycle_steps + period - phase], &base[cycle_steps], phase * sizeof(unsigned int));
+    }
+
+    // Rotates and gathers cycle_benchmark_frames frames at 3840x2160 without showing them
+    void benchmark(const Mat& counts) {
+        Mat sampled;
+        resize(counts, sampled, Size(cycle_benchmark_width, cycle_benchmark_height), 0, 0, INTER_NEAREST);
+        vector<unsigned int> colors(sampled.total());
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (int i = 0; i < cycle_benchmark_frames; i++) {
+            rotate(i / 60.);
+            gather_colors(lut.data(), (const unsigned int*)sampled.data, colors.data(), colors.size());
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << "Palette cycling at " << cycle_benchmark_width << "x" << cycle_benchmark_height << " without display: " << setprecision(3)
+            << cycle_benchmark_frames / seconds << " fps (" << seconds * 1000. / cycle_benchmark_frames << " ms per frame)" << endl;
+        lut = base;
+    }
+};
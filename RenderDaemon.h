@@ -0,0 +1,250 @@
+#pragma once
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <filesystem>
+#include "MellowSim.h"
+#include "FileUtil.h"
+
+// Headless batch rendering (MellowSim.exe --daemon <spool_dir>).
+// Every *.job file in the spool directory describes one render with key=value lines:
+//   x_start, x_end, y_start, y_end   view (required)
+//   output                           image path (required)
+//   width                            horizontal resolution, default 2048
+//   max_iter                         default derived from the magnification like in the interactive mode
+//   intensity, hue_shift, priority   optional, higher priority jobs are rendered first
+//   palette                          index into the palettes of colors.txt, 0 is the hue cycle
+//   depth                            bits per channel of the image: 8 (default), 16 (PNG/TIFF) or 32 (float TIFF/EXR)
+// Jobs run one after another on the shared RenderPool. A daemon claims one job at a time, the one with the highest
+// priority, so several daemons can share a spool directory. Finished job files are moved to done/ or failed/, the image
+// and a <output>.metrics.txt with timings are written to temporary files first and renamed into place.
+// A claimed job file (*.job.running) stays open without delete sharing until it is finished. Files left behind by a
+// crashed daemon can be renamed again, so they are put back into the queue on startup.
+
+const DWORD daemon_poll_ms = 1000;
+
+struct RenderJob {
+    filesystem::path job_file;
+    int priority = 0;
+    unsigned long long sequence = 0; // Keeps jobs of equal priority in arrival order (file time)
+    map<string, string> values;
+    chrono::steady_clock::time_point queued_at;
+    HANDLE claim_lock = INVALID_HANDLE_VALUE; // Keeps other daemons from requeueing the claimed file
+
+    bool operator<(const RenderJob& other) const { // Lower priority, or queued later
+        if (priority != other.priority) return priority < other.priority;
+        return sequence > other.sequence;
+    }
+};
+
+bool parse_job_file(const filesystem::path& path, RenderJob& job) {
+    ifstream file(path);
+    if (!file) return false;
+    string line;
+    while (getline(file, line)) {
+        size_t separator = line.find('=');
+        if (line.empty() || line[0] == '#' || separator == string::npos) continue;
+        string key = line.substr(0, separator);
+        string value = line.substr(separator + 1);
+        key.erase(key.find_last_not_of(" \t\r") + 1);
+        value.erase(0, value.find_first_not_of(" \t"));
+        value.erase(value.find_last_not_of(" \t\r") + 1);
+        job.values[key] = value;
+    }
+    try {
+        if (job.values.count("priority")) job.priority = stoi(job.values["priority"]);
+    }
+    catch (const exception&) {
+        cerr << "Invalid priority in " << path.filename().string() << endl;
+        return false;
+    }
+    return true;
+}
+
+void release_claim(RenderJob& job) {
+    if (job.claim_lock != INVALID_HANDLE_VALUE) CloseHandle(job.claim_lock);
+    job.claim_lock = INVALID_HANDLE_VALUE;
+}
+
+// Renames *.job.running files of crashed daemons back to *.job, files of running daemons can not be renamed
+void recover_orphaned_jobs(const string& spool_dir) {
+    int recovered = 0;
+    for (const auto& entry : filesystem::directory_iterator(spool_dir)) {
+        if (!entry.is_regular_file() || entry.path().extension() != ".running") continue;
+        filesystem::path job_file = entry.path();
+        job_file.replace_extension("");
+        if (job_file.extension() != ".job") continue;
+        error_code error;
+        filesystem::rename(entry.path(), job_file, error);
+        if (!error) recovered++;
+    }
+    if (recovered > 0) cout << "Requeued " << recovered << " jobs of a daemon which did not finish them" << endl;
+}
+
+void finish_job_file(const filesystem::path& job_file, const string& folder) {
+    filesystem::path destination = job_file.parent_path() / folder;
+    error_code error;
+    filesystem::create_directories(destination, error);
+    filesystem::path target = destination / job_file.filename();
+    target.replace_extension(""); // Strip .running
+    filesystem::rename(job_file, target, error);
+}
+
+template <typename T>
+bool run_render_job(RenderJob& job, string& error_message) {
+    const char* required[] = { "x_start", "x_end", "y_start", "y_end", "output" };
+    for (const char* key : required) {
+        if (!job.values.count(key)) {
+            error_message = string("missing ") + key;
+            return false;
+        }
+    }
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    long double x_start = stold(job.values["x_start"]);
+    long double x_end = stold(job.values["x_end"]);
+    long double y_start = stold(job.values["y_start"]);
+    long double y_end = stold(job.values["y_end"]);
+    int width = job.values.count("width") ? stoi(job.values["width"]) : 2048;
+    float job_intensity = job.values.count("intensity") ? stof(job.values["intensity"]) : 2.;
+    long double x_dist = x_start > x_end ? x_start - x_end : x_end - x_start;
+    long double y_dist = y_start > y_end ? y_start - y_end : y_end - y_start;
+    if (width <= 0 || x_dist <= 0 || y_dist <= 0) {
+        error_message = "empty view";
+        return false;
+    }
+    unsigned long long job_magnification = (unsigned long long)max((long double)1., (first_end_x - first_start_x) / x_dist);
+    float ratio = (float)(x_dist / y_dist);
+
+    MandelArea<T> area(x_start, x_end, y_start, y_end, ratio, width, job_intensity, job_magnification, false);
+    if (job.values.count("max_iter")) area.max_iter = stoul(job.values["max_iter"]);
+    if (job.values.count("hue_shift")) area.hue_shift = (unsigned short)stoi(job.values["hue_shift"]);
+    if (job.values.count("palette")) area.palette = (unsigned int)stoi(job.values["palette"]);
+    chrono::steady_clock::time_point render_begin = chrono::steady_clock::now();
+    if (!area.compute()) {
+        error_message = "unsupported pixel type";
+        return false;
+    }
+    chrono::steady_clock::time_point render_end = chrono::steady_clock::now();
+
+    filesystem::path output = job.values["output"];
+    error_code error;
+    if (output.has_parent_path()) filesystem::create_directories(output.parent_path(), error);
+    int depth = job.values.count("depth") ? stoi(job.values["depth"]) : 8;
+    Mat image = area.output_image(depth == 32 ? CV_32F : depth == 16 ? CV_16U : CV_8U);
+    if (!write_atomically(output, [&image](const string& path) { return imwrite(path, image); })) {
+        error_message = "could not write " + output.string();
+        return false;
+    }
+    chrono::steady_clock::time_point end = chrono::steady_clock::now();
+
+    auto ms = [](chrono::steady_clock::time_point a, chrono::steady_clock::time_point b) {
+        return chrono::duration_cast<chrono::milliseconds>(b - a).count();
+    };
+    long long render_ms = ms(render_begin, render_end);
+    filesystem::path metrics = output;
+    metrics.replace_filename(output.filename().string() + ".metrics.txt");
+    write_atomically(metrics, [&](const string& path) {
+        ofstream file(path);
+        file << "job=" << job.job_file.filename().string() << endl;
+        file << "width=" << area.width << endl;
+        file << "height=" << area.height << endl;
+        file << "max_iter=" << area.max_iter << endl;
+        file << "queue_ms=" << ms(job.queued_at, begin) << endl;
+        file << "render_ms=" << render_ms << endl;
+        file << "write_ms=" << ms(render_end, end) << endl;
+        file << "total_ms=" << ms(begin, end) << endl;
+        file << "pixels_per_s=" << (render_ms > 0 ? (long long)area.px_count * 1000 / render_ms : 0) << endl;
+        return (bool)file;
+    });
+    cout << "Finished " << output.string() << " in " << ms(begin, end) << "[ms]" << endl;
+    return true;
+}
+
+// Claims the job with the highest priority, the oldest first, by renaming it to *.job.running. Jobs which another
+// daemon claimed first are skipped, invalid ones are moved to failed/. false if there is no job.
+bool claim_next_job(const string& spool_dir, map<string, chrono::steady_clock::time_point>& first_seen, RenderJob& claimed_job) {
+    vector<RenderJob> candidates;
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    map<string, chrono::steady_clock::time_point> seen;
+    for (const auto& entry : filesystem::directory_iterator(spool_dir)) {
+        if (!entry.is_regular_file() || entry.path().extension() != ".job") continue;
+        error_code error;
+        RenderJob job;
+        job.job_file = entry.path();
+        job.sequence = (unsigned long long)entry.last_write_time(error).time_since_epoch().count();
+        auto known = first_seen.find(job.job_file.string());
+        job.queued_at = known != first_seen.end() ? known->second : now;
+        seen[job.job_file.string()] = job.queued_at;
+        parse_job_file(job.job_file, job); // Read again once claimed, an invalid file fails there
+        candidates.push_back(job);
+    }
+    first_seen.swap(seen);
+    sort(candidates.begin(), candidates.end(), [](const RenderJob& a, const RenderJob& b) { return b < a; });
+    for (RenderJob& candidate : candidates) {
+        filesystem::path claimed = candidate.job_file;
+        claimed += ".running";
+        error_code error;
+        filesystem::rename(candidate.job_file, claimed, error);
+        if (error) continue;
+        first_seen.erase(candidate.job_file.string());
+        RenderJob job;
+        job.job_file = claimed;
+        job.sequence = candidate.sequence;
+        job.queued_at = candidate.queued_at;
+        job.claim_lock = CreateFileA(claimed.string().c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (!parse_job_file(claimed, job)) {
+            cerr << "Job " << claimed.filename().string() << " could not be read." << endl;
+            release_claim(job);
+            finish_job_file(claimed, "failed");
+            continue;
+        }
+        claimed_job = job;
+        return true;
+    }
+    return false;
+}
+
+template <typename T>
+int run_render_daemon(const string& spool_dir) {
+    if (!filesystem::is_directory(spool_dir)) {
+        cerr << "Spool directory " << spool_dir << " does not exist." << endl;
+        return 1;
+    }
+    HANDLE change = FindFirstChangeNotificationA(spool_dir.c_str(), FALSE, FILE_NOTIFY_CHANGE_FILE_NAME);
+    recover_orphaned_jobs(spool_dir);
+    cout << "Render daemon watching " << spool_dir << " with " << get_render_pool().size() << " threads" << endl;
+
+    map<string, chrono::steady_clock::time_point> first_seen; // For the queue time of jobs which are not claimed yet
+    while (true) {
+        RenderJob job;
+        bool claimed = false;
+        try {
+            claimed = claim_next_job(spool_dir, first_seen, job);
+        }
+        catch (const exception& e) {
+            cerr << "Could not read the spool directory: " << e.what() << endl;
+        }
+        if (!claimed) {
+            if (change != INVALID_HANDLE_VALUE) {
+                WaitForSingleObject(change, daemon_poll_ms);
+                FindNextChangeNotification(change);
+            }
+            else Sleep(daemon_poll_ms);
+            continue;
+        }
+
+        cout << endl << "Rendering " << job.job_file.filename().string() << " (priority " << job.priority << ")" << endl;
+        string error_message;
+        bool success = false;
+        try {
+            success = run_render_job<T>(job, error_message);
+        }
+        catch (const exception& e) {
+            error_message = e.what();
+        }
+        if (!success) cerr << "Job " << job.job_file.filename().string() << " failed: " << error_message << endl;
+        release_claim(job);
+        finish_job_file(job.job_file, success ? "done" : "failed");
+    }
+    return 0;
+}
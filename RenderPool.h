@@ -0,0 +1,108 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <vector>
+
+using namespace std;
+
+// Warm thread pool shared by every render in the process, so no threads are started per frame or per job
+class RenderPool {
+public:
+    RenderPool(unsigned int n_threads) {
+        n_threads = n_threads <= 0 ? 1 : n_threads;
+        for (unsigned int i = 0; i < n_threads; i++) {
+            threads.push_back(thread([this] { work(); }));
+        }
+    }
+
+    ~RenderPool() {
+        {
+            lock_guard<mutex> lock(task_mutex);
+            stopping = true;
+        }
+        work_cv.notify_all();
+        for (thread& t : threads) t.join();
+    }
+
+    unsigned int size() const {
+        return (unsigned int)threads.size();
+    }
+
+    // Runs fn(0) ... fn(n - 1) on the pool and blocks until all calls returned.
+    // on_progress is called from the calling thread with the number of finished calls.
+    // Called from a task of the pool, the calls run inline, as the pool is busy with the outer loop.
+    void parallel_for(int n, const function<void(int)>& fn, const function<void(int)>& on_progress = nullptr) {
+        if (n <= 0) return;
+        if (inside_task) {
+            for (int i = 0; i < n; i++) fn(i);
+            if (on_progress) on_progress(n);
+            return;
+        }
+        lock_guard<mutex> call_lock(call_mutex);
+        unique_lock<mutex> lock(task_mutex);
+        task = &fn;
+        n_tasks = n;
+        next_index = 0;
+        finished = 0;
+        generation++;
+        work_cv.notify_all();
+        int reported = -1;
+        while (finished < n_tasks) {
+            if (on_progress && reported != finished) {
+                reported = finished;
+                lock.unlock();
+                on_progress(reported);
+                lock.lock();
+            }
+            done_cv.wait_for(lock, chrono::milliseconds(100), [this] { return finished >= n_tasks; });
+        }
+        task = nullptr;
+        lock.unlock();
+        if (on_progress) on_progress(n);
+    }
+
+private:
+    vector<thread> threads;
+    mutex call_mutex;
+    mutex task_mutex;
+    condition_variable work_cv;
+    condition_variable done_cv;
+    const function<void(int)>* task = nullptr;
+    int n_tasks = 0;
+    int next_index = 0;
+    int finished = 0;
+    unsigned long long generation = 0;
+    bool stopping = false;
+    static thread_local bool inside_task;
+
+    void work() {
+        unsigned long long seen_generation = 0;
+        unique_lock<mutex> lock(task_mutex);
+        while (true) {
+            work_cv.wait(lock, [&] { return stopping || (task != nullptr && generation != seen_generation); });
+            if (stopping) return;
+            seen_generation = generation;
+            while (task != nullptr && next_index < n_tasks) {
+                int index = next_index++;
+                const function<void(int)>* current = task;
+                lock.unlock();
+                inside_task = true;
+                (*current)(index);
+                inside_task = false;
+                lock.lock();
+                finished++;
+                if (finished == n_tasks) done_cv.notify_all();
+            }
+        }
+    }
+};
+
+thread_local bool RenderPool::inside_task = false;
+
+RenderPool& get_render_pool() {
+    static RenderPool pool(thread::hardware_concurrency());
+    return pool;
+}
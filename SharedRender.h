@@ -0,0 +1,339 @@
+#pragma once
+#include <atomic>
+#include <Windows.h>
+#include "MellowSim.h"
+
+// Multi-process rendering for very large frames.
+// Worker processes (MellowSim.exe --shm-worker) stay alive between frames and pull row tiles from a queue in
+// shared memory. Every tile is written straight into a shared iteration buffer owned by the front end.
+// All front ends on the machine share the same pool, a named mutex makes sure only one frame is in flight.
+
+const char* const shm_control_name = "Local\\MellowSimControl";
+const char* const shm_frame_prefix = "Local\\MellowSimFrame";
+const char* const shm_job_event_name = "Local\\MellowSimJob";
+const char* const shm_pool_mutex_name = "Local\\MellowSimPool";
+const char* const shm_job_object_name = "Local\\MellowSimWorkers";
+
+const unsigned int shm_magic = 0x4D534D50; // "MSMP"
+const unsigned int shm_version = 4;
+const int shm_tile_rows = 16;
+const unsigned int shm_max_tiles = 8192;
+const DWORD shm_heartbeat_ms = 250; // Workers stamp the tile they are working on this often, however long it takes
+const ULONGLONG shm_heartbeat_timeout_ms = 3000; // A claimed tile without a stamp for this long belongs to a dead worker
+const ULONGLONG shm_worker_idle_ms = 5 * 60 * 1000; // Idle workers exit after this time
+const SIZE_T shm_worker_memory_mb = 512; // Committed memory limit for every worker process
+
+// A tile state carries the job id in its upper bits, so workers which are still busy with an old job can never
+// claim or finish a tile of the current one. The claim counter carries it as well, see claim_shm_tile.
+const LONG TILE_FREE = 0;
+const LONG TILE_CLAIMED = 1;
+const LONG TILE_DONE = 2;
+const LONG TILE_TAKEN = 3; // Taken over by the front end from a worker which stopped responding
+
+inline LONG tile_state(LONG job, LONG state) {
+    return (LONG)(((ULONG)job << 2) | (ULONG)state);
+}
+
+struct ShmJob {
+    unsigned int n_tiles;
+    long double x_start;
+    long double x_end;
+    long double y_start;
+    long double y_end;
+    float ratio;
+    int width;
+    float intensity;
+    unsigned long long magnification;
+    unsigned int max_iter;
+    unsigned int kernel;
+    unsigned long long frame_size;
+};
+
+struct ShmControl {
+    unsigned int magic;
+    unsigned int version;
+    volatile LONG job_id; // Incremented before a new job is written
+    volatile LONG posted_job; // Set to job_id once all parameters of the job are valid
+    volatile LONG64 next_claim; // Job id in the upper, next tile in the lower 32 bits
+    ShmJob params;
+    volatile LONG tiles[shm_max_tiles];
+    volatile LONG64 heartbeats[shm_max_tiles]; // GetTickCount64 of the last sign of life of the tile's worker
+};
+
+// Next tile of job for the caller, -1 once the job has no more tiles or was replaced by a newer one
+LONG claim_shm_tile(ShmControl* control, LONG job, unsigned int n_tiles) {
+    while (true) {
+        LONG64 claim = control->next_claim;
+        if ((LONG)(claim >> 32) != job || (unsigned int)(claim & 0xFFFFFFFF) >= n_tiles) return -1;
+        if (InterlockedCompareExchange64(&control->next_claim, claim + 1, claim) == claim) {
+            LONG tile = (LONG)(claim & 0xFFFFFFFF);
+            if (InterlockedCompareExchange(&control->tiles[tile], tile_state(job, TILE_CLAIMED), tile_state(job, TILE_FREE)) == tile_state(job, TILE_FREE)) return tile;
+        }
+    }
+}
+
+string shm_frame_name(LONG job) {
+    return string(shm_frame_prefix) + to_string(job);
+}
+
+HANDLE shm_control_mapping = NULL;
+ShmControl* shm_control = nullptr;
+HANDLE shm_job_event = NULL;
+HANDLE shm_pool_mutex = NULL;
+HANDLE shm_job_object = NULL;
+
+unsigned int shm_active_workers() {
+    JOBOBJECT_BASIC_ACCOUNTING_INFORMATION info;
+    if (!QueryInformationJobObject(shm_job_object, JobObjectBasicAccountingInformation, &info, sizeof(info), NULL)) return 0;
+    return info.ActiveProcesses;
+}
+
+bool spawn_shm_worker() {
+    char exe_path[MAX_PATH];
+    if (GetModuleFileNameA(NULL, exe_path, MAX_PATH) == 0) return false;
+    string command = "\"" + string(exe_path) + "\" --shm-worker";
+
+    STARTUPINFOA startup_info;
+    PROCESS_INFORMATION process_info;
+    ZeroMemory(&startup_info, sizeof(startup_info));
+    startup_info.cb = sizeof(startup_info);
+    ZeroMemory(&process_info, sizeof(process_info));
+    if (!CreateProcessA(NULL, &command[0], NULL, NULL, FALSE, CREATE_NO_WINDOW | CREATE_SUSPENDED, NULL, NULL, &startup_info, &process_info)) {
+        return false;
+    }
+    AssignProcessToJobObject(shm_job_object, process_info.hProcess);
+    ResumeThread(process_info.hThread);
+    CloseHandle(process_info.hThread);
+    CloseHandle(process_info.hProcess);
+    return true;
+}
+
+// Opens the worker pool or creates it if this is the first front end on the machine
+bool open_shm_pool() {
+    if (shm_control != nullptr) return true;
+
+    shm_control_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(ShmControl), shm_control_name);
+    if (shm_control_mapping == NULL) return false;
+    bool created = GetLastError() != ERROR_ALREADY_EXISTS;
+    shm_control = (ShmControl*)MapViewOfFile(shm_control_mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(ShmControl));
+    if (shm_control == nullptr) {
+        CloseHandle(shm_control_mapping);
+        return false;
+    }
+    if (created) {
+        // Pagefile backed mappings start zeroed, so only the header has to be written
+        shm_control->magic = shm_magic;
+        shm_control->version = shm_version;
+    }
+    if (shm_control->magic != shm_magic || shm_control->version != shm_version) {
+        cerr << "Shared render pool was created by an incompatible MellowSim version." << endl;
+        UnmapViewOfFile(shm_control);
+        CloseHandle(shm_control_mapping);
+        shm_control = nullptr;
+        return false;
+    }
+
+    shm_job_event = CreateEventA(NULL, TRUE, FALSE, shm_job_event_name);
+    shm_pool_mutex = CreateMutexA(NULL, FALSE, shm_pool_mutex_name);
+    shm_job_object = CreateJobObjectA(NULL, shm_job_object_name);
+    if (shm_job_event == NULL || shm_pool_mutex == NULL || shm_job_object == NULL) return false;
+
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits;
+    ZeroMemory(&limits, sizeof(limits));
+    limits.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_PROCESS_MEMORY;
+    limits.ProcessMemoryLimit = shm_worker_memory_mb * 1024 * 1024;
+    SetInformationJobObject(shm_job_object, JobObjectExtendedLimitInformation, &limits, sizeof(limits));
+    return true;
+}
+
+// Tops the pool up to one worker per core, dead workers are replaced here as well
+void fill_shm_pool() {
+    auto processor_count = thread::hardware_concurrency();
+    processor_count = processor_count <= 0 ? 1 : processor_count;
+    unsigned int active = shm_active_workers();
+    for (unsigned int i = active; i < processor_count; i++) {
+        if (!spawn_shm_worker()) {
+            cerr << "Could not start render worker process." << endl;
+            break;
+        }
+    }
+}
+
+template <typename T>
+bool render_shared(MandelArea<T>& area) {
+    if (!open_shm_pool()) return false;
+    fill_shm_pool();
+
+    unsigned int n_tiles = (area.height + shm_tile_rows - 1) / shm_tile_rows;
+    if (n_tiles > shm_max_tiles) return false;
+    size_t row_size = (size_t)area.width * sizeof(unsigned int);
+    unsigned long long frame_size = (unsigned long long)row_size * area.height;
+
+    WaitForSingleObject(shm_pool_mutex, INFINITE);
+    // Invalidate the previous job first, stale workers check job_id before they touch a tile
+    LONG job = InterlockedIncrement(&shm_control->job_id);
+    HANDLE frame_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)(frame_size >> 32), (DWORD)frame_size, shm_frame_name(job).c_str());
+    char* frame = frame_mapping == NULL ? nullptr : (char*)MapViewOfFile(frame_mapping, FILE_MAP_ALL_ACCESS, 0, 0, frame_size);
+    if (frame == nullptr) {
+        if (frame_mapping != NULL) CloseHandle(frame_mapping);
+        ReleaseMutex(shm_pool_mutex);
+        return false;
+    }
+
+    shm_control->params.x_start = area.x_start;
+    shm_control->params.x_end = area.x_end;
+    shm_control->params.y_start = area.y_start;
+    shm_control->params.y_end = area.y_end;
+    shm_control->params.ratio = area.ratio;
+    shm_control->params.width = area.width;
+    shm_control->params.intensity = area.intensity;
+    shm_control->params.magnification = area.magnification;
+    shm_control->params.max_iter = area.max_iter;
+    shm_control->params.kernel = area.kernel;
+    shm_control->params.frame_size = frame_size;
+    shm_control->params.n_tiles = n_tiles;
+    ULONGLONG posted = GetTickCount64();
+    for (unsigned int i = 0; i < n_tiles; i++) {
+        InterlockedExchange64(&shm_control->heartbeats[i], (LONG64)posted);
+        InterlockedExchange(&shm_control->tiles[i], tile_state(job, TILE_FREE));
+    }
+    InterlockedExchange64(&shm_control->next_claim, (LONG64)job << 32);
+    InterlockedExchange(&shm_control->posted_job, job);
+    SetEvent(shm_job_event);
+
+    cout << endl << "Calculating Mandelbrot on " << shm_active_workers() << " worker processes." << endl;
+    // Slow tiles are fine as long as their worker is alive. Tiles of workers which stopped stamping them are taken
+    // over, so a late worker can not finish them any more; once no worker is left the unclaimed tiles are as well.
+    // Only tiles marked as done are read from the shared frame.
+    vector<unsigned char> local(n_tiles, 0);
+    unsigned int done_tiles = 0;
+    unsigned int taken_tiles = 0;
+    while (done_tiles + taken_tiles < n_tiles) {
+        Sleep(5);
+        ULONGLONG now = GetTickCount64();
+        unsigned int done_now = 0;
+        for (unsigned int i = 0; i < n_tiles; i++) {
+            LONG state = shm_control->tiles[i];
+            if (state == tile_state(job, TILE_DONE)) done_now++;
+            else if (state == tile_state(job, TILE_CLAIMED) && now - (ULONGLONG)shm_control->heartbeats[i] > shm_heartbeat_timeout_ms
+                && InterlockedCompareExchange(&shm_control->tiles[i], tile_state(job, TILE_TAKEN), state) == state) {
+                local[i] = 1;
+                taken_tiles++;
+            }
+        }
+        if (done_now != done_tiles) {
+            done_tiles = done_now;
+            show_progress_bar((float)done_tiles / (float)n_tiles);
+        }
+        if (shm_active_workers() == 0) {
+            LONG tile;
+            while ((tile = claim_shm_tile(shm_control, job, n_tiles)) >= 0) {
+                local[tile] = 1;
+                taken_tiles++;
+            }
+            for (unsigned int i = 0; i < n_tiles; i++) {
+                if (InterlockedCompareExchange(&shm_control->tiles[i], tile_state(job, TILE_TAKEN), tile_state(job, TILE_CLAIMED)) == tile_state(job, TILE_CLAIMED)) {
+                    local[i] = 1;
+                    taken_tiles++;
+                }
+            }
+            break;
+        }
+    }
+    ResetEvent(shm_job_event);
+
+    // Tiles of crashed workers are rendered here on all cores, straight into the iteration buffer
+    vector<int> local_tiles;
+    for (unsigned int i = 0; i < n_tiles; i++) {
+        if (local[i]) local_tiles.push_back(i);
+    }
+    if (!local_tiles.empty()) {
+        cerr << "Render workers stopped responding, calculating " << local_tiles.size() << " tiles locally." << endl;
+        int n_local = (int)local_tiles.size();
+        get_render_pool().parallel_for(n_local, [&](int i) {
+            int tile = local_tiles[i];
+            area.calculate_iterations(tile * shm_tile_rows, shm_tile_rows, &area.iterations[(size_t)tile * shm_tile_rows * area.width]);
+        }, [n_local](int finished) { show_progress_bar((float)finished / (float)n_local); });
+    }
+    for (unsigned int i = 0; i < n_tiles; i++) {
+        if (local[i]) continue;
+        size_t offset = (size_t)i * shm_tile_rows * row_size;
+        memcpy((char*)area.iterations.data() + offset, frame + offset, (size_t)min((unsigned long long)shm_tile_rows * row_size, frame_size - offset));
+    }
+    ReleaseMutex(shm_pool_mutex);
+
+    UnmapViewOfFile(frame);
+    CloseHandle(frame_mapping);
+    return true;
+}
+
+template <typename T>
+int run_shm_worker() {
+    HANDLE control_mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, shm_control_name);
+    HANDLE job_event = OpenEventA(SYNCHRONIZE, FALSE, shm_job_event_name);
+    if (control_mapping == NULL || job_event == NULL) {
+        cerr << "No shared render pool found." << endl;
+        return 1;
+    }
+    ShmControl* control = (ShmControl*)MapViewOfFile(control_mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(ShmControl));
+    if (control == nullptr || control->magic != shm_magic || control->version != shm_version) return 1;
+
+    // Stamps the tile in progress, the front end only takes it over once the stamps stop
+    atomic<LONG> current_tile(-1);
+    atomic<bool> running(true);
+    thread heartbeat([&] {
+        while (running) {
+            LONG tile = current_tile;
+            if (tile >= 0) InterlockedExchange64(&control->heartbeats[tile], (LONG64)GetTickCount64());
+            Sleep(shm_heartbeat_ms);
+        }
+    });
+
+    LONG last_job = 0;
+    ULONGLONG last_active = GetTickCount64();
+    while (GetTickCount64() - last_active < shm_worker_idle_ms) {
+        if (WaitForSingleObject(job_event, 1000) != WAIT_OBJECT_0) continue;
+        LONG job = control->posted_job;
+        if (job == last_job || job != control->job_id) {
+            Sleep(1);
+            continue;
+        }
+        last_job = job;
+        last_active = GetTickCount64();
+
+        // The parameters are copied first and only used if no newer job started writing them meanwhile
+        ShmJob params = control->params;
+        MemoryBarrier();
+        if (control->job_id != job || control->posted_job != job) continue;
+
+        HANDLE frame_mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, shm_frame_name(job).c_str());
+        if (frame_mapping == NULL) continue;
+        char* frame = (char*)MapViewOfFile(frame_mapping, FILE_MAP_ALL_ACCESS, 0, 0, params.frame_size);
+        if (frame == nullptr) {
+            CloseHandle(frame_mapping);
+            continue;
+        }
+        MandelArea<T> area(params.x_start, params.x_end, params.y_start, params.y_end, params.ratio, params.width, params.intensity, params.magnification, false);
+        area.max_iter = params.max_iter;
+        area.kernel = params.kernel;
+        area.prepare_kernel();
+        size_t row_size = (size_t)area.width * sizeof(unsigned int);
+        LONG tile;
+        while ((tile = claim_shm_tile(control, job, params.n_tiles)) >= 0) {
+            InterlockedExchange64(&control->heartbeats[tile], (LONG64)GetTickCount64());
+            current_tile = tile;
+            area.calculate_iterations(tile * shm_tile_rows, shm_tile_rows, (unsigned int*)(frame + tile * shm_tile_rows * row_size));
+            current_tile = -1;
+            InterlockedCompareExchange(&control->tiles[tile], tile_state(job, TILE_DONE), tile_state(job, TILE_CLAIMED));
+        }
+        UnmapViewOfFile(frame);
+        CloseHandle(frame_mapping);
+    }
+
+    running = false;
+    heartbeat.join();
+    UnmapViewOfFile(control);
+    CloseHandle(control_mapping);
+    CloseHandle(job_event);
+    return 0;
+}
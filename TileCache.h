@@ -0,0 +1,541 @@
+#pragma once
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <algorithm>
+#include <cstddef>
+#include "MellowSim.h"
+#include "FileUtil.h"
+
+// Quadtree tile pyramid of iteration counts shared by all views.
+// Level L samples the plane on a global lattice with 1/2^L of the home view's pixel spacing, lattice point
+// (grid_x, grid_y) lies at grid_x * spacing_x - grid_y * spacing_y * i. A view which starts on a lattice point of
+// its level can take every cached tile it overlaps and only has to render the rest.
+// The cache is opt-in: views on the lattice zoom by powers of two, so clicks and guided zooms do not follow
+// zoom_factor while it is enabled.
+
+const int tile_size = 64;
+const size_t tile_cache_budget_mb = 256;
+const int lattice_base_width = 2048;
+const long double lattice_base_x = ((long double)first_end_x - first_start_x) / lattice_base_width;
+const long double lattice_base_y = ((long double)first_start_y - first_end_y) / (int)(lattice_base_width / aspect_ratio);
+
+// Deeper levels need lattice coordinates beyond long long and pixel spacings beyond the long double precision of
+// the coordinates, views there are not aligned to the lattice
+const int max_tile_level = 48;
+
+bool use_tile_cache = false;
+
+struct TileKey {
+    int level;
+    long long tile_x;
+    long long tile_y;
+    unsigned int max_iter;
+    unsigned int kernel;
+
+    bool operator==(const TileKey& other) const {
+        return level == other.level && tile_x == other.tile_x && tile_y == other.tile_y && max_iter == other.max_iter && kernel == other.kernel;
+    }
+};
+
+struct TileKeyHash {
+    size_t operator()(const TileKey& key) const {
+        size_t h = hash<long long>()(key.tile_x);
+        h = h * 31 + hash<long long>()(key.tile_y);
+        h = h * 31 + key.level;
+        h = h * 31 + key.max_iter;
+        return h * 31 + key.kernel;
+    }
+};
+
+typedef shared_ptr<const vector<unsigned int>> TileData;
+
+// Iteration tiles with an LRU memory budget
+class TileCache {
+public:
+    unsigned long long hits = 0;
+    unsigned long long misses = 0;
+    unsigned long long evictions = 0;
+
+    TileCache(size_t budget_bytes) {
+        this->budget_bytes = budget_bytes;
+    }
+
+    TileData find(const TileKey& key) {
+        lock_guard<mutex> lock(cache_mutex);
+        auto entry = tiles.find(key);
+        if (entry == tiles.end()) {
+            misses++;
+            return nullptr;
+        }
+        hits++;
+        lru.splice(lru.begin(), lru, entry->second.second);
+        return entry->second.first;
+    }
+
+    bool contains(const TileKey& key) {
+        lock_guard<mutex> lock(cache_mutex);
+        return tiles.count(key) > 0;
+    }
+
+    void insert(const TileKey& key, vector<unsigned int>&& counts) {
+        lock_guard<mutex> lock(cache_mutex);
+        if (tiles.count(key)) return;
+        TileData data = make_shared<const vector<unsigned int>>(move(counts));
+        lru.push_front(key);
+        tiles[key] = make_pair(data, lru.begin());
+        used_bytes += data->size() * sizeof(unsigned int);
+        while (used_bytes > budget_bytes && !lru.empty()) {
+            auto oldest = tiles.find(lru.back());
+            used_bytes -= oldest->second.first->size() * sizeof(unsigned int);
+            tiles.erase(oldest);
+            lru.pop_back();
+            evictions++;
+        }
+    }
+
+    void reset_counters() {
+        lock_guard<mutex> lock(cache_mutex);
+        hits = 0;
+        misses = 0;
+        evictions = 0;
+    }
+
+    void print_stats() {
+        lock_guard<mutex> lock(cache_mutex);
+        cout << "Tile cache: " << hits << " hits, " << misses << " misses, " << evictions << " evicted, " << tiles.size() << " tiles (" << used_bytes / (1024 * 1024) << " MB)" << endl;
+    }
+
+private:
+    size_t budget_bytes;
+    size_t used_bytes = 0;
+    mutex cache_mutex;
+    list<TileKey> lru;
+    unordered_map<TileKey, pair<TileData, list<TileKey>::iterator>, TileKeyHash> tiles;
+};
+
+TileCache& get_tile_cache() {
+    static TileCache cache(tile_cache_budget_mb * 1024 * 1024);
+    return cache;
+}
+
+// Persistent tile cache in a memory mapped file (cache/tiles.bin), the second level behind TileCache.
+// Layout: header, one DiskCacheSlot per tile, then the tile data of the slots in use so far, the file grows with them.
+// A slot is only marked valid after its data and checksum were written and every read verifies the checksum and
+// the key, so torn writes after a crash and tiles evicted by another instance sharing the file show up as misses.
+// A header from another version or lattice makes the file start over empty.
+
+const char* const disk_cache_file = "cache/tiles.bin";
+const size_t disk_cache_budget_mb = 1024;
+const char disk_cache_magic[8] = { 'M', 'S', 'T', 'I', 'L', 'E', 'S', '\0' };
+const unsigned int disk_cache_version = 2;
+const unsigned int disk_cache_grow_slots = 1024; // 16 MB of tiles at a time
+const char* const disk_cache_mutex = "Local\\MellowSimTileCache";
+
+bool use_disk_cache = true;
+
+#pragma pack(push, 1)
+struct DiskCacheHeader {
+    char magic[8];
+    unsigned int version;
+    unsigned int tile_size;
+    unsigned int slot_count;
+    double base_x;
+    double base_y;
+    unsigned int checksum; // Covers everything above
+    unsigned long long clock; // Incremented on every access, orders the slots for eviction
+};
+
+struct DiskCacheSlot {
+    int level;
+    long long tile_x;
+    long long tile_y;
+    unsigned int max_iter;
+    unsigned int kernel;
+    unsigned long long last_used;
+    unsigned int checksum; // Of the tile data
+    unsigned int valid;
+};
+#pragma pack(pop)
+
+// Held around every access to the file, so instances sharing it (the window, the daemon, workers) see whole slots
+class DiskCacheFileLock {
+public:
+    DiskCacheFileLock(HANDLE mutex) : mutex(mutex) {
+        if (mutex != NULL) WaitForSingleObject(mutex, INFINITE); // An abandoned lock is taken over, torn slots fail their checksum
+    }
+
+    ~DiskCacheFileLock() {
+        if (mutex != NULL) ReleaseMutex(mutex);
+    }
+
+private:
+    HANDLE mutex;
+};
+
+class DiskTileCache {
+public:
+    unsigned long long hits = 0;
+    unsigned long long misses = 0;
+    unsigned long long corrupted = 0;
+
+    ~DiskTileCache() {
+        close();
+        if (file_mutex != NULL) CloseHandle(file_mutex);
+    }
+
+    bool is_open() const {
+        return view != nullptr;
+    }
+
+    bool open(const string& path, size_t budget_bytes) {
+        lock_guard<mutex> lock(disk_mutex);
+        if (file_mutex == NULL) file_mutex = CreateMutexA(NULL, FALSE, disk_cache_mutex);
+        DiskCacheFileLock file_lock(file_mutex);
+        slot_count = (unsigned int)(budget_bytes / (sizeof(DiskCacheSlot) + tile_bytes));
+        CreateDirectory(disk_cache_dir, NULL);
+
+        if (!map_file(path, false)) return false;
+        if (!header_valid()) {
+            cout << "Tile cache file " << path << " is missing or outdated, starting a new one." << endl;
+            unmap_file();
+            if (!map_file(path, true)) return false;
+            memcpy(header->magic, disk_cache_magic, sizeof(disk_cache_magic));
+            header->version = disk_cache_version;
+            header->tile_size = tile_size;
+            header->slot_count = slot_count;
+            header->base_x = (double)lattice_base_x;
+            header->base_y = (double)lattice_base_y;
+            header->checksum = checksum(header, offsetof(DiskCacheHeader, checksum));
+            header->clock = 0;
+        }
+
+        lru_position.resize(slot_count);
+        slot_keys.resize(slot_count);
+        adopt_slots(0, mapped_slots);
+        cout << "Tile cache file holds " << index.size() << " of " << slot_count << " tiles." << endl;
+        return true;
+    }
+
+    void close() {
+        lock_guard<mutex> lock(disk_mutex);
+        unmap_file();
+    }
+
+    bool contains(const TileKey& key) {
+        lock_guard<mutex> lock(disk_mutex);
+        return index.count(key) > 0;
+    }
+
+    // Hands the mapped tile data to reader without copying it
+    bool read(const TileKey& key, const function<void(const unsigned int*)>& reader) {
+        lock_guard<mutex> lock(disk_mutex);
+        auto entry = index.find(key);
+        if (entry == index.end()) {
+            misses++;
+            return false;
+        }
+        DiskCacheFileLock file_lock(file_mutex);
+        unsigned int slot = entry->second;
+        if (slots[slot].valid != 1 || !(key_of(slots[slot]) == key)) {
+            // Another instance evicted the tile
+            misses++;
+            release(slot);
+            return false;
+        }
+        const unsigned int* counts = tile_data(slot);
+        if (checksum(counts, tile_bytes) != slots[slot].checksum) {
+            corrupted++;
+            misses++;
+            release(slot);
+            return false;
+        }
+        reader(counts);
+        touch(slot);
+        hits++;
+        return true;
+    }
+
+    void write(const TileKey& key, const unsigned int* counts) {
+        lock_guard<mutex> lock(disk_mutex);
+        if (!is_open() || index.count(key)) return;
+        DiskCacheFileLock file_lock(file_mutex);
+        // Free slots which another instance filled in the meantime are skipped
+        while (!free_slots.empty() && slots[free_slots.back()].valid == 1) free_slots.pop_back();
+        if (free_slots.empty() && mapped_slots < slot_count && !grow()) return;
+        if (free_slots.empty()) {
+            if (lru.empty()) return;
+            release(lru.back());
+        }
+        unsigned int slot = free_slots.back();
+        free_slots.pop_back();
+
+        DiskCacheSlot& entry = slots[slot];
+        entry.valid = 0;
+        memcpy(tile_data(slot), counts, tile_bytes);
+        entry.level = key.level;
+        entry.tile_x = key.tile_x;
+        entry.tile_y = key.tile_y;
+        entry.max_iter = key.max_iter;
+        entry.kernel = key.kernel;
+        entry.checksum = checksum(counts, tile_bytes);
+        entry.valid = 1;
+
+        index[key] = slot;
+        slot_keys[slot] = key;
+        lru.push_front(slot);
+        lru_position[slot] = lru.begin();
+        touch(slot);
+    }
+
+    void flush() {
+        lock_guard<mutex> lock(disk_mutex);
+        if (is_open()) FlushViewOfFile(view, 0);
+    }
+
+    void reset_counters() {
+        hits = 0;
+        misses = 0;
+        corrupted = 0;
+    }
+
+    void print_stats() {
+        lock_guard<mutex> lock(disk_mutex);
+        cout << "Disk tile cache: " << hits << " hits, " << misses << " misses, " << corrupted << " corrupted, " << index.size() << " of " << slot_count << " tiles" << endl;
+    }
+
+private:
+    const size_t tile_bytes = tile_size * tile_size * sizeof(unsigned int);
+    unsigned int slot_count = 0;
+    unsigned int mapped_slots = 0; // Slots whose data the file already holds, it grows by disk_cache_grow_slots
+    unsigned long long file_size = 0;
+    string file_path;
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+    HANDLE file_mutex = NULL;
+    char* view = nullptr;
+    DiskCacheHeader* header = nullptr;
+    DiskCacheSlot* slots = nullptr;
+    mutex disk_mutex;
+    unordered_map<TileKey, unsigned int, TileKeyHash> index;
+    list<unsigned int> lru;
+    vector<list<unsigned int>::iterator> lru_position;
+    vector<TileKey> slot_keys; // Key every indexed slot had when this instance indexed it
+    vector<unsigned int> free_slots;
+
+    static TileKey key_of(const DiskCacheSlot& slot) {
+        return { slot.level, slot.tile_x, slot.tile_y, slot.max_iter, slot.kernel };
+    }
+
+    unsigned long long data_offset() const {
+        return sizeof(DiskCacheHeader) + (unsigned long long)slot_count * sizeof(DiskCacheSlot);
+    }
+
+    unsigned int* tile_data(unsigned int slot) {
+        return (unsigned int*)(view + data_offset() + slot * tile_bytes);
+    }
+
+    // A new or truncated file only holds the header and the slot table, tile data is added by grow()
+    bool map_file(const string& path, bool truncate) {
+        file_path = path;
+        file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, truncate ? CREATE_ALWAYS : OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) {
+            cerr << "Could not open tile cache file " << path << endl;
+            return false;
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size)) size.QuadPart = 0;
+        unsigned long long full_size = data_offset() + (unsigned long long)slot_count * tile_bytes;
+        return map_view(min(max((unsigned long long)size.QuadPart, data_offset()), full_size));
+    }
+
+    // Maps size bytes of the file, growing it (zero filled) if it is shorter
+    bool map_view(unsigned long long size) {
+        file_size = size;
+        mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, (DWORD)(file_size >> 32), (DWORD)file_size, NULL);
+        view = mapping == NULL ? nullptr : (char*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, file_size);
+        if (view == nullptr) {
+            cerr << "Could not map " << file_size / (1024 * 1024) << " MB of tile cache file " << file_path << endl;
+            unmap_file();
+            return false;
+        }
+        header = (DiskCacheHeader*)view;
+        slots = (DiskCacheSlot*)(view + sizeof(DiskCacheHeader));
+        mapped_slots = (unsigned int)((file_size - data_offset()) / tile_bytes);
+        return true;
+    }
+
+    void unmap_view() {
+        if (view != nullptr) {
+            FlushViewOfFile(view, 0);
+            UnmapViewOfFile(view);
+        }
+        if (mapping != NULL) CloseHandle(mapping);
+        view = nullptr;
+        mapping = NULL;
+        header = nullptr;
+        slots = nullptr;
+    }
+
+    void unmap_file() {
+        unmap_view();
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+        mapped_slots = 0;
+    }
+
+    // Adds room for disk_cache_grow_slots more tiles, or takes over what another instance already added
+    bool grow() {
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size)) size.QuadPart = 0;
+        unsigned int first = mapped_slots;
+        unsigned long long wanted = data_offset() + (unsigned long long)min(slot_count, mapped_slots + disk_cache_grow_slots) * tile_bytes;
+        unmap_view();
+        if (!map_view(max(wanted, min((unsigned long long)size.QuadPart, data_offset() + (unsigned long long)slot_count * tile_bytes)))) {
+            unmap_file();
+            index.clear();
+            lru.clear();
+            free_slots.clear();
+            return false;
+        }
+        adopt_slots(first, mapped_slots);
+        return true;
+    }
+
+    // Indexes the valid slots in [first, last), most recently used first, behind the ones indexed already
+    void adopt_slots(unsigned int first, unsigned int last) {
+        vector<pair<unsigned long long, unsigned int>> used;
+        for (unsigned int i = first; i < last; i++) {
+            if (slots[i].valid == 1 && !index.count(key_of(slots[i]))) used.push_back(make_pair(slots[i].last_used, i));
+            else if (slots[i].valid != 1) free_slots.push_back(i);
+        }
+        sort(used.rbegin(), used.rend());
+        for (auto& entry : used) {
+            slot_keys[entry.second] = key_of(slots[entry.second]);
+            index[slot_keys[entry.second]] = entry.second;
+            lru.push_back(entry.second);
+            lru_position[entry.second] = prev(lru.end());
+        }
+    }
+
+    bool header_valid() {
+        return file_size >= sizeof(DiskCacheHeader)
+            && memcmp(header->magic, disk_cache_magic, sizeof(disk_cache_magic)) == 0
+            && header->version == disk_cache_version
+            && header->tile_size == tile_size
+            && header->slot_count == slot_count
+            && header->base_x == (double)lattice_base_x
+            && header->base_y == (double)lattice_base_y
+            && header->checksum == checksum(header, offsetof(DiskCacheHeader, checksum))
+            && (file_size - data_offset()) % tile_bytes == 0;
+    }
+
+    void touch(unsigned int slot) {
+        slots[slot].last_used = ++header->clock;
+        lru.splice(lru.begin(), lru, lru_position[slot]);
+    }
+
+    // Drops the slot from this instance's index; its data is only invalidated if it still is the indexed tile
+    void release(unsigned int slot) {
+        const TileKey key = slot_keys[slot];
+        DiskCacheSlot& entry = slots[slot];
+        if (entry.valid == 1 && key_of(entry) == key) entry.valid = 0;
+        index.erase(key);
+        lru.erase(lru_position[slot]);
+        if (entry.valid != 1) free_slots.push_back(slot);
+    }
+};
+
+DiskTileCache* get_disk_tile_cache() {
+    static DiskTileCache cache;
+    static bool opened = use_disk_cache && cache.open(disk_cache_file, disk_cache_budget_mb * 1024 * 1024);
+    return opened && use_disk_cache ? &cache : nullptr;
+}
+
+long long floor_div(long long a, long long b) {
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+// A view of the given width which starts on lattice point (grid_x, grid_y) of level, at most max_tile_level
+template <typename T>
+MandelArea<T> lattice_area(int level, long long grid_x, long long grid_y, float ratio, int width, float intensity) {
+    long double spacing_x = lattice_base_x / ldexp(1.0L, level);
+    long double spacing_y = lattice_base_y / ldexp(1.0L, level);
+    int height = width / ratio;
+    long double x_start = grid_x * spacing_x;
+    long double y_start = -grid_y * spacing_y;
+    MandelArea<T> area(x_start, x_start + width * spacing_x, y_start, y_start - height * spacing_y, ratio, width, intensity, 1ULL << min(level, max_tile_level), false);
+    area.level = level;
+    area.grid_x = grid_x;
+    area.grid_y = grid_y;
+    return area;
+}
+
+// Calls fn(key, tile origin in view pixels) for every tile the view overlaps
+template <typename T, typename F>
+void for_each_tile(const MandelArea<T>& area, F fn) {
+    long long first_tx = floor_div(area.grid_x, tile_size);
+    long long first_ty = floor_div(area.grid_y, tile_size);
+    long long last_tx = floor_div(area.grid_x + area.width - 1, tile_size);
+    long long last_ty = floor_div(area.grid_y + area.height - 1, tile_size);
+    for (long long ty = first_ty; ty <= last_ty; ty++) {
+        for (long long tx = first_tx; tx <= last_tx; tx++) {
+            TileKey key = { area.level, tx, ty, area.max_iter, area.kernel };
+            fn(key, (int)(tx * tile_size - area.grid_x), (int)(ty * tile_size - area.grid_y));
+        }
+    }
+}
+
+// Copies every cached tile into the iteration buffer and marks its pixels as known
+template <typename T>
+void assemble_from_tiles(MandelArea<T>& area) {
+    TileCache& cache = get_tile_cache();
+    DiskTileCache* disk = get_disk_tile_cache();
+    cache.reset_counters();
+    if (disk != nullptr) disk->reset_counters();
+    for_each_tile(area, [&](const TileKey& key, int origin_x, int origin_y) {
+        auto copy_tile = [&](const unsigned int* counts) {
+            for (int ty = max(0, -origin_y); ty < tile_size && origin_y + ty < area.height; ty++) {
+                int first_tx = max(0, -origin_x);
+                int last_tx = min(tile_size, area.width - origin_x);
+                size_t px = (size_t)(origin_y + ty) * area.width + origin_x;
+                memcpy(&area.iterations[px + first_tx], &counts[ty * tile_size + first_tx], (last_tx - first_tx) * sizeof(unsigned int));
+                memset(&area.known[px + first_tx], 1, last_tx - first_tx);
+            }
+        };
+        TileData tile = cache.find(key);
+        if (tile != nullptr) {
+            copy_tile(tile->data());
+            return;
+        }
+        if (disk == nullptr) return;
+        disk->read(key, [&](const unsigned int* counts) {
+            copy_tile(counts);
+            cache.insert(key, vector<unsigned int>(counts, counts + tile_size * tile_size));
+        });
+    });
+}
+
+// Stores the tiles which lie completely inside the rendered view
+template <typename T>
+void store_tiles(MandelArea<T>& area) {
+    TileCache& cache = get_tile_cache();
+    DiskTileCache* disk = get_disk_tile_cache();
+    for_each_tile(area, [&](const TileKey& key, int origin_x, int origin_y) {
+        if (origin_x < 0 || origin_y < 0 || origin_x + tile_size > area.width || origin_y + tile_size > area.height) return;
+        bool in_memory = cache.contains(key);
+        bool on_disk = disk == nullptr || disk->contains(key);
+        if (in_memory && on_disk) return;
+        vector<unsigned int> counts(tile_size * tile_size);
+        for (int ty = 0; ty < tile_size; ty++) {
+            memcpy(&counts[ty * tile_size], &area.iterations[(size_t)(origin_y + ty) * area.width + origin_x], tile_size * sizeof(unsigned int));
+        }
+        if (!on_disk) disk->write(key, counts.data());
+        if (!in_memory) cache.insert(key, move(counts));
+    });
+    cache.print_stats();
+    if (disk != nullptr) {
+        disk->flush();
+        disk->print_stats();
+    }
+}
@@ -0,0 +1,213 @@
+#pragma once
+#include <deque>
+#include <sstream>
+#include "MellowSim.h"
+
+// Zoom history with a memory budget.
+// Only the current level keeps its full buffers. When a level is left by zooming in, its iteration counts are
+// packed into a lossless PNG snapshot next to a small thumbnail. If the snapshots exceed the budget, the oldest
+// levels drop to the thumbnail alone and are rendered again (mostly from the tile caches) when navigated back to.
+
+const size_t history_budget_mb = 64;
+const int history_thumbnail_width = w_width / 4;
+
+// Sessions store every level with its exact view in a text file, snapshots of the iteration counts go next to it
+const string session_dir = "sessions/";
+const string session_header = "mellowsim_session 1";
+bool session_snapshots = true;
+
+template <typename T>
+class ZoomHistory {
+public:
+    void push(MandelArea<T>&& area) {
+        if (!levels.empty()) {
+            compress(levels.back());
+        }
+        levels.push_back(Level(move(area)));
+        enforce_budget();
+        cout << "History: " << levels.size() << " levels, " << used_bytes() / 1024 << " KB in snapshots" << endl;
+    }
+
+    // The previous level is only restored when it is accessed, so popping several levels at once stays cheap
+    void pop() {
+        levels.pop_back();
+    }
+
+    // Replaces the current level, e.g. by its parent view when zooming out of the root
+    void replace_top(MandelArea<T>&& area) {
+        levels.pop_back();
+        levels.push_back(Level(move(area)));
+    }
+
+    MandelArea<T>& top() {
+        Level& level = levels.back();
+        if (!level.live) restore(level);
+        return level.area;
+    }
+
+    size_t size() const {
+        return levels.size();
+    }
+
+    // One line per level, root first. Coordinates are written with enough digits to read back the exact values.
+    bool save_session(const string& name) {
+        CreateDirectory(session_dir.c_str(), NULL);
+        ofstream file(session_dir + name + ".session");
+        if (!file) return false;
+        file << session_header << endl << levels.size() << endl;
+        file << setprecision(numeric_limits<long double>::max_digits10);
+        for (size_t i = 0; i < levels.size(); i++) {
+            Level& level = levels[i];
+            MandelArea<T>& area = level.area;
+            string snapshot = "-";
+            if (session_snapshots) {
+                vector<uchar> encoded;
+                if (level.live) encode_counts(area, encoded);
+                const vector<uchar>& bytes = level.live ? encoded : level.snapshot;
+                if (!bytes.empty()) {
+                    snapshot = name + "_" + to_string(i) + ".png";
+                    ofstream png(session_dir + snapshot, ios::binary | ios::trunc);
+                    png.write((const char*)bytes.data(), bytes.size());
+                }
+            }
+            file << area.x_start << " " << area.x_end << " " << area.y_start << " " << area.y_end << " "
+                << area.x_per_px << " " << area.y_per_px << " " << area.ratio << " " << area.width << " "
+                << area.magnification << " " << area.max_iter << " " << area.kernel << " " << area.level << " "
+                << area.grid_x << " " << area.grid_y << " " << area.intensity << " " << area.hue_shift << " " << snapshot << endl;
+        }
+        return (bool)file;
+    }
+
+    // Replaces the history by a stored session. No level is rendered here, the deepest one is restored from its
+    // snapshot by the next top() and the others only when navigated back to.
+    bool load_session(const string& name) {
+        ifstream file(session_dir + name + ".session");
+        string header;
+        size_t n_levels = 0;
+        if (!getline(file, header) || header != session_header || !(file >> n_levels) || n_levels == 0) return false;
+        deque<Level> loaded;
+        string line;
+        getline(file, line);
+        while (loaded.size() < n_levels && getline(file, line)) {
+            istringstream values(line);
+            long double x_start, x_end, y_start, y_end, x_per_px, y_per_px;
+            float ratio, level_intensity;
+            int width, level;
+            unsigned long long level_magnification;
+            unsigned int max_iter, kernel;
+            long long grid_x, grid_y;
+            unsigned short hue_shift;
+            string snapshot;
+            if (!(values >> x_start >> x_end >> y_start >> y_end >> x_per_px >> y_per_px >> ratio >> width >> level_magnification
+                >> max_iter >> kernel >> level >> grid_x >> grid_y >> level_intensity >> hue_shift >> snapshot)) return false;
+            MandelArea<T> area(x_start, x_end, y_start, y_end, ratio, width, level_intensity, level_magnification, false);
+            area.x_start = x_start;
+            area.x_end = x_end;
+            area.y_start = y_start;
+            area.y_end = y_end;
+            area.x_per_px = x_per_px;
+            area.y_per_px = y_per_px;
+            area.update_mirror_sum();
+            area.max_iter = max_iter;
+            area.kernel = kernel;
+            area.level = level;
+            area.grid_x = grid_x;
+            area.grid_y = grid_y;
+            area.hue_shift = hue_shift;
+            loaded.push_back(Level(move(area)));
+            loaded.back().live = false;
+            if (snapshot != "-") {
+                ifstream png(session_dir + snapshot, ios::binary);
+                loaded.back().snapshot.assign(istreambuf_iterator<char>(png), istreambuf_iterator<char>());
+            }
+        }
+        if (loaded.size() != n_levels) return false;
+        levels.swap(loaded);
+        enforce_budget();
+        return true;
+    }
+
+private:
+    struct Level {
+        MandelArea<T> area;
+        vector<uchar> snapshot; // PNG of the iteration counts, every count split over 4 channels
+        Mat thumbnail;
+        bool live = true;
+
+        Level(MandelArea<T>&& area) : area(move(area)) {}
+    };
+
+    deque<Level> levels; // deque keeps references to the top level valid while pushing
+
+    size_t used_bytes() const {
+        size_t bytes = 0;
+        for (const Level& level : levels) {
+            bytes += level.snapshot.size() + level.thumbnail.total() * level.thumbnail.elemSize();
+        }
+        return bytes;
+    }
+
+    // Every count is split over the 4 channels of a PNG pixel
+    static void encode_counts(MandelArea<T>& area, vector<uchar>& encoded) {
+        if (area.iterations.size() != (size_t)area.px_count) return;
+        Mat packed(area.height, area.width, CV_8UC4, area.iterations.data());
+        vector<int> params = { IMWRITE_PNG_COMPRESSION, 1 };
+        imencode(".png", packed, encoded, params);
+    }
+
+    void compress(Level& level) {
+        if (!level.live) return;
+        MandelArea<T>& area = level.area;
+        encode_counts(area, level.snapshot);
+        if (!area.display.empty()) {
+            resize(area.display, level.thumbnail, Size(history_thumbnail_width, history_thumbnail_width / area.ratio), INTER_AREA);
+        }
+        vector<unsigned int>().swap(area.iterations);
+        vector<float>().swap(area.smooth);
+        vector<CappedPixel>().swap(area.capped);
+        area.clear_supersamples();
+        area.img.release();
+        area.display.release();
+        level.live = false;
+    }
+
+    // Oldest levels lose their snapshots first, the level below the current one is the last to go
+    void enforce_budget() {
+        size_t budget = history_budget_mb * 1024 * 1024;
+        size_t used = used_bytes();
+        for (size_t i = 0; i + 1 < levels.size() && used > budget; i++) {
+            used -= levels[i].snapshot.size();
+            vector<uchar>().swap(levels[i].snapshot);
+        }
+    }
+
+    void restore(Level& level) {
+        MandelArea<T>& area = level.area;
+        chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+        Mat packed;
+        if (!level.snapshot.empty()) packed = imdecode(level.snapshot, IMREAD_UNCHANGED);
+        if (packed.type() == CV_8UC4 && (int)packed.total() == area.px_count) {
+            area.iterations.assign((unsigned int*)packed.data, (unsigned int*)packed.data + area.px_count);
+            area.colorize();
+            if (area.supersample) area.supersample_edges();
+            area.update_display();
+            cout << "Restored level from its snapshot";
+        }
+        else {
+            if (!level.thumbnail.empty()) {
+                Mat preview;
+                resize(level.thumbnail, preview, Size(w_width, w_width / area.ratio), INTER_LINEAR);
+                imshow(w_name, preview);
+                waitKey(1);
+            }
+            area.compute();
+            area.update_display();
+            cout << "Rendered level again";
+        }
+        chrono::steady_clock::time_point end = chrono::steady_clock::now();
+        cout << " in " << chrono::duration_cast<chrono::milliseconds>(end - begin).count() << "[ms]" << endl;
+        vector<uchar>().swap(level.snapshot);
+        level.thumbnail.release();
+        level.live = true;
+    }
+};
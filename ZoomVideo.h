@@ -0,0 +1,226 @@
+#pragma once
+#include <map>
+#include <sstream>
+#include "MellowSim.h"
+
+// Headless zoom videos. The path comes from a guided zoom script (zooms/*.txt) or from a target point with its
+// magnification. Between two views of the path the zoom is exponential around the point which both views show at the
+// same place, with video_frames_per_2x frames for every halving of the width.
+// Frames are rendered in parallel, one per thread, and written in order.
+
+const int video_width = 1280;
+const double video_fps = 30.;
+int video_frames_per_2x = 30;
+
+struct ZoomView {
+    long double center_x;
+    long double center_y;
+    long double x_dist;
+    long double y_dist;
+};
+
+ZoomView home_zoom_view() {
+    return { ((long double)first_start_x + first_end_x) / 2, ((long double)first_start_y + first_end_y) / 2,
+        (long double)first_end_x - first_start_x, (long double)first_start_y - first_end_y };
+}
+
+// Replays the clicks of a guided zoom like onChange does without snapping, starting from the home view
+vector<ZoomView> script_zoom_path(const string& path, float zoom_factor) {
+    vector<ZoomView> views = { home_zoom_view() };
+    ifstream file(path);
+    int recorded_width;
+    if (!(file >> recorded_width) || recorded_width <= 0) return {};
+    float x_factor = (float)w_width / recorded_width;
+    float y_factor = (float)w_height / (int)(recorded_width / aspect_ratio);
+    int zoom_width = w_width * zoom_factor;
+    int zoom_height = w_height * zoom_factor;
+    int x, y;
+    while (file >> x >> y) {
+        const ZoomView& view = views.back();
+        int corrected_x = min(max((int)round(x * x_factor) - zoom_width / 2, 0), w_width - zoom_width);
+        int corrected_y = min(max((int)round(y * y_factor) - zoom_height / 2, 0), w_height - zoom_height);
+        long double start_x = view.center_x - view.x_dist / 2 + corrected_x * view.x_dist / w_width;
+        long double start_y = view.center_y + view.y_dist / 2 - corrected_y * view.y_dist / w_height;
+        long double x_dist = zoom_width * view.x_dist / w_width;
+        long double y_dist = zoom_height * view.y_dist / w_height;
+        views.push_back({ start_x + x_dist / 2, start_y - y_dist / 2, x_dist, y_dist });
+    }
+    return views;
+}
+
+// Every frame of the video along the path
+vector<ZoomView> zoom_frames(const vector<ZoomView>& path) {
+    vector<ZoomView> frames;
+    for (size_t i = 0; i + 1 < path.size(); i++) {
+        const ZoomView& from = path[i];
+        const ZoomView& to = path[i + 1];
+        long double scale = to.x_dist / from.x_dist;
+        int n_frames = max(1, (int)llroundl(video_frames_per_2x * fabsl(log2l(scale))));
+        // Fixed point of the mapping from one view to the other, it stays at the same place in every frame
+        long double fixed_x = scale == 1 ? 0 : (to.center_x - from.center_x * scale) / (1 - scale);
+        long double fixed_y = scale == 1 ? 0 : (to.center_y - from.center_y * scale) / (1 - scale);
+        for (int frame = 0; frame < n_frames; frame++) {
+            long double t = (long double)frame / n_frames;
+            long double s = powl(scale, t);
+            if (scale == 1) frames.push_back({ from.center_x + (to.center_x - from.center_x) * t, from.center_y + (to.center_y - from.center_y) * t, from.x_dist, from.y_dist });
+            else frames.push_back({ fixed_x + (from.center_x - fixed_x) * s, fixed_y + (from.center_y - fixed_y) * s, from.x_dist * s, from.y_dist * s });
+        }
+    }
+    if (!path.empty()) frames.push_back(path.back());
+    return frames;
+}
+
+// Writes frames through a cv::VideoWriter for .avi (MJPG) and .mp4 (mp4v), as numbered PNGs into a directory otherwise
+class VideoOutput {
+public:
+    bool open(const string& output, Size size) {
+        path = output;
+        string extension = output.size() > 4 ? output.substr(output.size() - 4) : "";
+        sequence = extension != ".avi" && extension != ".mp4";
+        if (sequence) {
+            CreateDirectory(output.c_str(), NULL);
+            return true;
+        }
+        int fourcc = extension == ".mp4" ? VideoWriter::fourcc('m', 'p', '4', 'v') : VideoWriter::fourcc('M', 'J', 'P', 'G');
+        if (writer.open(output, fourcc, video_fps, size)) return true;
+        cerr << "Could not open " << output << " for writing." << endl;
+        return false;
+    }
+
+    void write(const Mat& image) {
+        if (sequence) {
+            ostringstream name;
+            name << path << "/frame_" << setfill('0') << setw(5) << n_written << ".png";
+            imwrite(name.str(), image);
+        }
+        else writer.write(image);
+        n_written++;
+    }
+
+    void close() {
+        writer.release();
+    }
+
+private:
+    string path;
+    bool sequence = true;
+    VideoWriter writer;
+    int n_written = 0;
+};
+
+template <typename T>
+MandelArea<T> video_frame_area(const ZoomView& view, float intensity) {
+    const ZoomView home = home_zoom_view();
+    unsigned long long frame_magnification = max(1ULL, (unsigned long long)(home.x_dist / view.x_dist));
+    return MandelArea<T>(view.center_x - view.x_dist / 2, view.center_x + view.x_dist / 2, view.center_y + view.y_dist / 2, view.center_y - view.y_dist / 2,
+        aspect_ratio, video_width, intensity, frame_magnification, false);
+}
+
+// The limit of the deepest view, every frame of a video uses it so the palette does not drift with the magnification
+template <typename T>
+unsigned int video_max_iter(const vector<ZoomView>& frames, float intensity) {
+    const ZoomView* deepest = &frames.front();
+    for (const ZoomView& view : frames) {
+        if (view.x_dist < deepest->x_dist) deepest = &view;
+    }
+    return video_frame_area<T>(*deepest, intensity).max_iter;
+}
+
+// Runs on the calling thread from start to end, the video renderer already keeps every core busy with one frame each
+template <typename T>
+Mat render_video_frame(const ZoomView& view, float intensity, unsigned int max_iter) {
+    MandelArea<T> area = video_frame_area<T>(view, intensity);
+    area.max_iter = max_iter;
+    area.prepare_kernel();
+    area.iterations.assign(area.px_count, 0);
+    area.calculate_iterations(0, area.height, area.iterations.data());
+    vector<uchar> lut = MandelArea<T>::template scaled_lut<uchar>(area.palette_lut(), 255.f);
+    Mat image(area.height, area.width, CV_8UC3);
+    for (int y = 0; y < area.height; y++) area.colorize_row(image, y, 0, area.width, lut, false);
+    return image;
+}
+
+// Quality and cost of synthesized frames against frames rendered directly with the same max_iter and palette.
+// synthesized[i] is frame frame_numbers[i] of the n_frames which took seconds in total.
+template <typename T>
+void compare_to_direct(const vector<Mat>& synthesized, const vector<ZoomView>& views, const vector<int>& frame_numbers,
+    float intensity, unsigned int max_iter, int n_frames, double seconds) {
+    if (synthesized.empty()) return;
+    double direct_seconds = 0;
+    for (size_t i = 0; i < synthesized.size(); i++) {
+        chrono::steady_clock::time_point direct_begin = chrono::steady_clock::now();
+        Mat direct = render_video_frame<T>(views[i], intensity, max_iter);
+        direct_seconds += chrono::duration<double>(chrono::steady_clock::now() - direct_begin).count();
+        cout << "Frame " << frame_numbers[i] << ": PSNR " << setprecision(4) << PSNR(synthesized[i], direct) << " dB against direct rendering" << endl;
+    }
+    // Direct frames run one per thread in the video renderer
+    double direct_total = direct_seconds / synthesized.size() * n_frames / max(1u, thread::hardware_concurrency());
+    cout << "Direct rendering would take about " << setprecision(4) << direct_total << " s, " << direct_total / seconds << " times as long" << endl;
+}
+
+// Renders the frames on all cores and writes them in order, returns the process exit code
+template <typename T>
+int render_zoom_video(const vector<ZoomView>& path, const string& output, float intensity) {
+    histogram_coloring = false; // Each frame's histogram would recolor it, like a changing max_iter
+    vector<ZoomView> frames = zoom_frames(path);
+    if (frames.size() < 2) {
+        cerr << "The zoom path needs at least two views." << endl;
+        return 1;
+    }
+    VideoOutput video;
+    if (!video.open(output, Size(video_width, (int)(video_width / aspect_ratio)))) return 1;
+    unsigned int max_iter = video_max_iter<T>(frames, intensity);
+    cout << "Rendering " << frames.size() << " frames of " << video_width << " px to " << output << " (max_iter=" << max_iter << ")" << endl;
+
+    // Finished frames wait here until all earlier ones are written, at most max_ahead frames are in flight
+    unsigned int n_threads = max(1u, thread::hardware_concurrency());
+    int n_frames = (int)frames.size();
+    int max_ahead = 2 * n_threads;
+    mutex frames_mutex;
+    condition_variable frames_cv;
+    map<int, Mat> finished;
+    int next_frame = 0;
+    int written = 0;
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (unsigned int i = 0; i < n_threads; i++) {
+        threads.push_back(thread([&] {
+            while (true) {
+                int frame;
+                {
+                    unique_lock<mutex> lock(frames_mutex);
+                    frames_cv.wait(lock, [&] { return next_frame >= n_frames || next_frame < written + max_ahead; });
+                    if (next_frame >= n_frames) return;
+                    frame = next_frame++;
+                }
+                Mat image = render_video_frame<T>(frames[frame], intensity, max_iter);
+                lock_guard<mutex> lock(frames_mutex);
+                finished[frame] = image;
+                frames_cv.notify_all();
+            }
+        }));
+    }
+    while (written < n_frames) {
+        Mat image;
+        {
+            unique_lock<mutex> lock(frames_mutex);
+            frames_cv.wait(lock, [&] { return finished.count(written) > 0; });
+            image = finished[written];
+            finished.erase(written);
+        }
+        video.write(image);
+        {
+            lock_guard<mutex> lock(frames_mutex);
+            written++;
+        }
+        frames_cv.notify_all();
+        show_progress_bar((float)written / n_frames);
+    }
+    for (thread& t : threads) t.join();
+    video.close();
+    chrono::steady_clock::time_point end = chrono::steady_clock::now();
+    double seconds = chrono::duration<double>(end - begin).count();
+    cout << "Rendered " << n_frames << " frames in " << setprecision(4) << seconds << " s (" << n_frames / seconds << " fps)" << endl;
+    get_orbit_cache().print_stats();
+    return 0;
+}